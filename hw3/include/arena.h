@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Per-line scratch memory. Strings produced while expanding a command line
+ * (glob matches, variable values) are carved out of large chunks and all
+ * released together by arenaReset() when the next line is read, instead of
+ * being malloc'ed and freed one by one.
+ */
+void* arenaAlloc(size_t size);
+
+/*
+ * Copy len bytes of s into the arena and NUL-terminate them.
+ */
+char* arenaStrndup(const char* s, size_t len);
+
+/*
+ * Release everything allocated since the last reset.
+ */
+void arenaReset();
+
+#endif
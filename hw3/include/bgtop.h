@@ -0,0 +1,20 @@
+#ifndef BGTOP_H
+#define BGTOP_H
+
+#include "linkedList.h"
+
+/*
+ * The bgtop builtin: print state, CPU% and RSS of every stage of every
+ * background job from /proc/<pid>/stat and /proc/<pid>/statm.
+ *
+ * @param interval seconds between refreshes, 0 to print once
+ * @param count number of refreshes, 0 to refresh until a line is entered
+ */
+void bgtop(List_t* bgList, int interval, int count);
+
+/*
+ * Close every cached /proc fd. Used on exit.
+ */
+void bgtopClose();
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "icssh.h"
+#include "linkedList.h"
+
+#define CAPTURE_JOB_MAX (64 * 1024)     // ring size cap per stream of one job
+#define CAPTURE_TOTAL_MAX (1024 * 1024) // cap on all capture rings together
+
+#define CAPTURE_OUT 0
+#define CAPTURE_ERR 1
+
+/*
+ * Bounded byte ring. Once full, new output overwrites the oldest bytes.
+ *
+ * data - storage, grown on demand up to CAPTURE_JOB_MAX
+ * cap - current size of data
+ * total - number of bytes ever written; the ring holds the last min(total, cap)
+ */
+typedef struct ringbuf {
+    char* data;
+    size_t cap;
+    unsigned long long total;
+} ringbuf_t;
+
+/*
+ * Captured stdout/stderr of one background job. Owned by its bgentry_t
+ * while the job runs, then kept on a retired list until read or evicted.
+ */
+typedef struct capture {
+    pid_t pid;                // pid of the (first) background process
+    char* line;               // copy of the command line
+    int rfds[2];              // read ends drained by the event loop, -1 once at EOF
+    int wfds[2];              // write ends handed to the children, -1 once closed
+    ringbuf_t rings[2];       // CAPTURE_OUT and CAPTURE_ERR
+    struct capture* next;     // next capture on the retired list
+} capture_t;
+
+extern int captureEnabled;
+
+/*
+ * Create the pipes for a new background job and start draining them.
+ * @return NULL if capture is disabled or the pipes cannot be created
+ */
+capture_t* captureOpen(job_info* job);
+
+/*
+ * In the child: point stderr (and stdout if withOut) at the capture pipes.
+ * File redirections done afterwards still take precedence.
+ */
+void captureChild(capture_t* cap, int withOut);
+
+/*
+ * In the parent: close the write ends once every child has been forked.
+ */
+void captureCloseWriters(capture_t* cap);
+
+/*
+ * Called when the owning bgentry_t is freed. Unread output is kept on the
+ * retired list so `bgout` still works after the job was reaped.
+ */
+void captureRetire(capture_t* cap);
+
+/*
+ * In a forked child that carries on as a shell (after eventForget): close
+ * this process's copies of the pipes without reading what the parent is
+ * owed, and free cap.
+ */
+void captureForget(capture_t* cap);
+
+/*
+ * The bgout builtin: print the buffered output of pid. With follow set,
+ * keep printing until the job closes its output or a line is entered.
+ * @return 0 on success, -1 if pid has no captured output
+ */
+int captureShow(List_t* bgList, pid_t pid, int follow);
+
+/*
+ * Free every retired capture. Used on exit.
+ */
+void captureFreeAll();
+
+#endif
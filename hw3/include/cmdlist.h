@@ -0,0 +1,63 @@
+#ifndef CMDLIST_H
+#define CMDLIST_H
+
+#include "linkedList.h"
+
+/*
+ * Command lists: pipelines joined by `;`, `&&` and `||`, and grouped with
+ * `( ... )`. The parser from icsshlib only knows single pipelines, so an
+ * input line is split into one first, and the shell runs the pipelines one
+ * at a time through the usual path, short-circuiting on their exit status.
+ *
+ * `&&` and `||` bind equally tightly and from the left, `;` and `&` least,
+ * as in sh. `&` applies to the pipeline before it, or to the whole `&&`/`||`
+ * chain before it, which then runs like a `( ... ) &` group.
+ *
+ * A group only gets its own process when it must: when it runs in the
+ * background, or contains a builtin that changes the shell (cd, export,
+ * exit, ...). Otherwise its pipelines run like any others.
+ *
+ * The list is a tree stored in preorder: a group is followed by its
+ * contents and a CMD_GROUP_END, and knows where that is, so a group that is
+ * skipped or run elsewhere is passed over in one step.
+ */
+typedef enum cmd_type {
+    CMD_PIPELINE,
+    CMD_GROUP,
+    CMD_GROUP_END,
+} cmd_type_t;
+
+typedef enum cmd_link {
+    CMD_SEQ,    // runs whatever the previous status was (first, or after ; or &)
+    CMD_AND,    // runs if the previous status was 0
+    CMD_OR,     // runs if it was not
+} cmd_link_t;
+
+typedef struct cmd_item {
+    cmd_type_t type;
+    cmd_link_t link;
+    char* text;     // the pipeline as validate_input takes it; a group's source
+    int end;        // CMD_GROUP: index of its CMD_GROUP_END
+    int fork;       // CMD_GROUP: runs in a child process
+    int bg;         // CMD_GROUP: ... which is not waited for
+} cmd_item_t;
+
+/*
+ * The next pipeline to run (malloc'd), given the wait status of the one run
+ * last (builtins included): the next one of the current list that the
+ * status does not skip, or else the first of the next input line, read by
+ * recordNextLine and added to the history. NULL at the end of input.
+ *
+ * Forks and waits for the groups that need it; a background group is added
+ * to bgList. In a group's process this returns each of the group's
+ * pipelines and then exits with the last status.
+ */
+char* cmdNextLine(const char* prompt, int status, List_t* bgList);
+
+/*
+ * The exit builtin: in a group's process, exit it with exit's argument, or
+ * the last status without one. Returns only in the shell itself.
+ */
+void cmdExitGroup(job_info* job);
+
+#endif
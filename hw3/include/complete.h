@@ -0,0 +1,27 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#define COMPLETE_MAX_DIRS 63    // PATH directories tracked; one bit each, bit 63 is the builtins
+
+/*
+ * Tab completion of command names. The first word of a command (and the
+ * first word after a |) completes from the builtins and the executables in
+ * every $PATH directory; anything else falls back to readline's file names.
+ *
+ * The names are kept in a prefix trie built on the first completion. The
+ * PATH directories are watched with inotify on the event loop, so the trie
+ * follows installs and removals without rescanning. A changed PATH or a lost
+ * inotify event rebuilds it on the next completion.
+ */
+
+/*
+ * Register the completion function with readline.
+ */
+void completeInit();
+
+/*
+ * Drop the trie and the inotify watches. Used on exit.
+ */
+void completeClose();
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+/*
+ * Server mode: 53shell --listen <path> serves any number of clients on a
+ * Unix domain socket (SOCK_SEQPACKET, one command line per packet).
+ *
+ * A client passes its stdin, stdout and stderr with SCM_RIGHTS on its first
+ * packet, optionally followed by a directory fd to start from (any later
+ * packet carrying fds replaces them). Every job is started with those fds
+ * and the client's own working directory, which cd changes for that client
+ * only. Every line is answered with one packet:
+ *
+ *     <seq> exit <pid> <code>    the line is done (pid 0 for builtins and
+ *                                lines that could not be run)
+ *     <seq> bg <pid>             a background job was started; its
+ *                                "<seq> exit <pid> <code>" follows when it ends
+ *
+ * seq counts the client's lines from 1. Jobs of a client that disconnects
+ * are killed.
+ */
+
+#define DAEMON_LINE_MAX 4096
+#define DAEMON_BACKLOG 64
+
+/*
+ * Listen on path and serve clients until SIGINT or SIGTERM.
+ * @return the exit status for the shell
+ */
+int daemonServe(const char* path);
+
+#endif
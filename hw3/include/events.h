@@ -0,0 +1,63 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Callback invoked by the event loop when a registered fd becomes ready.
+ *
+ * @param fd the file descriptor that is ready
+ * @param events the epoll event mask that was reported
+ * @param arg the pointer given to eventAdd
+ */
+typedef void (*event_cb)(int fd, unsigned int events, void* arg);
+
+/*
+ * Register fd with the shell's event loop. Only one callback may be
+ * registered per fd.
+ * @return 0 on success, -1 on error
+ */
+int eventAdd(int fd, unsigned int events, event_cb cb, void* arg);
+
+/*
+ * Stop watching fd. The fd itself is left open.
+ */
+void eventRemove(int fd);
+
+/*
+ * Wait up to timeout milliseconds (-1 blocks) for registered fds and
+ * dispatch their callbacks.
+ * @return number of callbacks run, -1 on error
+ */
+int eventPoll(int timeout);
+
+/*
+ * Like eventPoll, but also returns as soon as fd is readable.
+ * @return 1 if fd is readable, 0 otherwise
+ */
+int eventPollWith(int fd, int timeout);
+
+/*
+ * readline input function (rl_getc_function) that keeps the event loop
+ * running while the shell sits at the prompt.
+ */
+int eventGetc(FILE* stream);
+
+/*
+ * In a forked child that carries on as a shell: drop the event loop it
+ * shares with the parent (the epoll instance and the callbacks), so that
+ * it neither runs the parent's callbacks nor changes what the parent
+ * watches. The fds that were registered are left to their owners; removing
+ * them afterwards is a no-op, and the next eventAdd starts a loop of the
+ * child's own.
+ */
+void eventForget();
+
+/*
+ * Wait for the foreground child pid while still servicing the event loop.
+ * Same contract as waitpid(pid, status, 0).
+ */
+pid_t waitForeground(pid_t pid, int* status);
+
+#endif
@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include "linkedList.h"
 #include "icssh.h"
+#include "jobopts.h"
+#include "capture.h"
 
 static void sio_ltoa(long v, char s[], int b);
 
@@ -22,7 +24,11 @@ static void sio_reverse(char s[]);
 
 void freeAndNull(job_info* job, char* line);
 
-void changeDir(job_info* job);
+/*
+ * The cd builtin.
+ * @return 0 on success, -1 (after printing DIR_ERR) on failure
+ */
+int changeDir(job_info* job);
 
 int redirectionCheck(job_info* job);
 
@@ -32,6 +38,34 @@ int openOut(job_info* job, char* line);
 
 int openErr(job_info* job, char* line);
 
-void piping(job_info* job, char* line, List_t* bgList);
+/*
+ * Run every process of job connected by pipes.
+ * @return wait status of the last stage of a foreground job, 0 for a
+ * background job, -1 if a stage prefix is invalid
+ */
+int piping(job_info* job, char* line, List_t* bgList, job_opts_t* opts);
+
+/*
+ * In the child: apply capture, prefixes and redirections, then exec the
+ * job's (single) process. Never returns.
+ * @param envp the environment, from varsEnviron() called in the shell before
+ * fork, so that the array it caches is the shell's and not the child's copy
+ */
+void execJob(job_info* job, char* line, job_opts_t* opts, capture_t* cap, char** envp);
+
+/*
+ * Convert a wait status into a shell exit code (128+signal if killed).
+ */
+int exitCode(int status);
+
+/*
+ * The -c one-shot mode: parse and run one command line. cd, exit, export
+ * and unset run as builtins, as with sh -c; the other builtins only make
+ * sense in an interactive shell and are looked up as programs.
+ * @return the exit status for the shell
+ */
+int runCommandString(char* cmdLine);
+
+void traceCommand(job_info* job);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef HISTFILE_H
+#define HISTFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HIST_FILE ".53shell_history"        // under $HOME; .idx and .lock next to it
+#define HIST_RECENT 500                     // newest entries given to readline at startup
+#define HIST_INDEX_SLACK (1024 * 1024)      // unindexed bytes tolerated before exit compacts
+#define HIST_MAGIC "53HIDX1"
+
+/*
+ * Persistent history. The log is plain text, one entry per line, appended
+ * with O_APPEND and memory-mapped rather than read, so startup does not
+ * depend on its size. A trigram index covers the log up to indexedLen; the
+ * entries appended after that are searched by scanning.
+ *
+ * Index file layout:
+ *     hist_index_t
+ *     uint64_t entryOff[nentries]      start of every entry in the log
+ *     hist_bucket_t buckets[nbuckets]  open-addressed by trigram
+ *     uint32_t postings[npostings]     entry numbers, ascending per trigram
+ *
+ * Compaction rewrites the log keeping only the newest copy of every entry
+ * and rebuilds the index. It holds an exclusive flock on the .lock file;
+ * appending holds a shared one, so any number of shells can share the
+ * files and pick up a compacted log by its new inode.
+ */
+typedef struct hist_index {
+    char magic[8];
+    uint64_t logIno;        // inode of the log this index belongs to
+    uint64_t indexedLen;    // bytes of the log covered
+    uint64_t nentries;
+    uint64_t nbuckets;      // a power of 2
+    uint64_t npostings;
+} hist_index_t;
+
+typedef struct hist_bucket {
+    uint32_t key;           // trigram + 1; 0 for an empty bucket
+    uint32_t count;
+    uint64_t off;           // first posting of the trigram
+} hist_bucket_t;
+
+/*
+ * Map the history of $HOME and give its newest entries to readline. Binds
+ * ^R to an indexed reverse search on the current line.
+ */
+void histInit();
+
+/*
+ * Record a line. Empty lines, lines starting with a space and repeats of
+ * the previous line are skipped.
+ */
+void histAppend(const char* line);
+
+/*
+ * Find the newest entry that contains query and starts before offset before
+ * in the log.
+ * @return its offset, or -1 if there is none
+ */
+long long histFind(const char* query, size_t before);
+
+/*
+ * Deduplicate the log and rebuild the index.
+ * @return number of entries kept, -1 on error
+ */
+long long histCompact();
+
+/*
+ * Unmap the history. Compacts in a child process first if the log has
+ * outgrown its index.
+ */
+void histClose();
+
+/*
+ * The history builtin: history [count] | history -s <text ...> | history -c
+ */
+void historyCommand(int argc, char** argv);
+
+#endif
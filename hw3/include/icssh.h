@@ -12,11 +12,26 @@
 
 #define RD_ERR "REDIRECTION ERROR: Invalid operators or file combination.\n"
 #define BG_TERM "Background process %d: %s, has terminated.\n"
+#define BG_DETACH "Background process %d: %s, left running.\n"
 #define DIR_ERR "DIRECTORY ERROR: Directory does not exist.\n"
 #define EXEC_ERR "EXEC ERROR: Cannot execute %s.\n"
 #define WAIT_ERR "WAIT ERROR: An error ocured while waiting for the process.\n"
 #define PID_ERR "PROCESS ERROR: Process pid does not exist.\n"
 #define PIPE_ERR "PIPE ERROR: Invalid use of pipe operators.\n"
+#define OPT_ERR "OPTION ERROR: Invalid use of the %s prefix.\n"
+#define POLICY_ERR "POLICY ERROR: Cannot apply %s to the process.\n"
+#define TIMEOUT_MSG "TIMEOUT: Process %d exceeded its %d second limit.\n"
+#define TRACE_ERR "TRACE ERROR: Cannot write the trace to %s.\n"
+#define VAR_ERR "VARIABLE ERROR: %s is not a valid identifier.\n"
+#define DAEMON_ERR "DAEMON ERROR: Cannot listen on %s.\n"
+#define HIST_ERR "HISTORY ERROR: Cannot rewrite the history file.\n"
+#define RECORD_ERR "RECORD ERROR: Cannot open %s.\n"
+#define PIPESIZE_ERR "PIPE ERROR: Cannot set the pipe capacity to %s.\n"
+#define MEMO_ERR "MEMO ERROR: Cannot create the cache directory.\n"
+#define LIST_ERR "LIST ERROR: Unexpected %s.\n"
+#define METRICS_ERR "METRICS ERROR: Cannot create %s.\n"
+#define JOBS_ERR "JOBS ERROR: Cannot open the job table; it may be in use by another shell.\n"
+#define BGOUT_ERR "BGOUT ERROR: No captured output for process %d.\n"
 
 #ifdef DEBUG
 #define SHELL_PROMPT "<53shell>$ "
@@ -45,6 +60,14 @@ typedef struct bgentry {
 	job_info *job;   // the job that the bgentry refers to
 	pid_t pid;       // pid of the (first) background process
 	time_t seconds;  // time at which the command recieved by the shell
+	struct capture *capture;  // captured stdout/stderr of the job; NULL if not captured
+	struct job_opts *opts;    // prefixes the job was started with; NULL if none
+	pid_t *pids;              // pids of every stage of a pipeline; NULL for a single process
+	int nstages;              // number of processes in the job
+	int running;              // number of those not yet reaped
+	int status;               // wait status of the last stage, once reaped
+	struct pipestat *stats;   // throughput of the pipes between stages; NULL if not measured
+	int slot;                 // its row in the persisted job table; -1 if not persisted
 } bgentry_t;
 
 /*
@@ -0,0 +1,81 @@
+#ifndef JOBOPTS_H
+#define JOBOPTS_H
+
+#include "icssh.h"
+#include <sched.h>
+#include <sys/resource.h>
+
+#define JOBOPTS_MAX_LIMITS 8
+#define POLICY_INHERIT -1
+
+/*
+ * Options given as prefixes in front of a command, e.g.
+ * `timeout 5 affinity 2-3 priority 10 sched batch ulimit -t 60 cmd`.
+ * The prefixes are removed from argv before the command is run. They are
+ * not named taskset and nice, so that those commands still run as usual.
+ * Prefixes on the first stage of a pipeline apply to every stage; prefixes
+ * on a later stage apply to that stage only.
+ *
+ * timeout - seconds the job may run before it is terminated, 0 for no limit
+ * hasAffinity/cpus - CPUs the job is pinned to (sched_setaffinity)
+ * hasNice/nice - nice value (setpriority)
+ * policy - SCHED_OTHER, SCHED_BATCH or SCHED_IDLE; POLICY_INHERIT to leave it
+ * limits - resource limits (setrlimit), soft and hard set to the same value
+ * pipeSize - capacity of the pipes between stages, 0 for the kernel default
+ * pipeStat - relay and measure the pipes between stages (see pipestat.h)
+ * memo - replay the output of an earlier identical run (see memo.h); only
+ *        for a single foreground process
+ *
+ * pipesize and pipestat concern the pipes, so they only count on the first
+ * stage. Without a command after them, pipesize, pipestat and memo are the
+ * builtins of the same name.
+ */
+typedef struct job_opts {
+    int timeout;
+    int hasAffinity;
+    cpu_set_t cpus;
+    int hasNice;
+    int nice;
+    int policy;
+    int nlimits;
+    struct {
+        int resource;
+        rlim_t value;
+    } limits[JOBOPTS_MAX_LIMITS];
+    int pipeSize;
+    int pipeStat;
+    int memo;
+} job_opts_t;
+
+/*
+ * Strip every leading option prefix from the first process of job into
+ * opts, then fill in the defaults for anything not given.
+ * @return 0 on success, -1 if a prefix is malformed or no command is left
+ */
+int stripJobOpts(job_info* job, job_opts_t* opts);
+
+/*
+ * Strip the prefixes of a later pipeline stage. opts must start out as a
+ * copy of the job's options.
+ * @return 0 on success, -1 if a prefix is malformed or no command is left
+ */
+int stripStageOpts(proc_info* proc, job_opts_t* opts);
+
+/*
+ * Apply the scheduling and resource options in the child, before exec.
+ * @return 0 on success, -1 (after printing POLICY_ERR) on failure
+ */
+int applyJobOpts(job_opts_t* opts);
+
+/*
+ * Does opts change anything about how the job is run?
+ */
+int hasJobOpts(job_opts_t* opts);
+
+/*
+ * Describe opts as the prefixes that would produce them, e.g.
+ * "affinity 0-3 priority 10". Used by bglist.
+ */
+void formatJobOpts(job_opts_t* opts, char* buf, size_t size);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef JOBTABLE_H
+#define JOBTABLE_H
+
+#include "linkedList.h"
+#include <stdint.h>
+
+#define JOBTABLE_FILE ".53shell_jobs"   // under $HOME
+#define JOBTABLE_MAGIC "53JOBS1"
+#define JOBTABLE_SLOTS 64
+#define JOBTABLE_STAGES 8               // longer pipelines are not persisted
+#define JOBTABLE_LINE 256
+
+/*
+ * Persisted background jobs (`bgpersist on`). The background job list is
+ * mirrored into a memory-mapped file, which survives the shell crashing,
+ * and `exit` leaves the jobs running instead of killing them. A shell that
+ * starts while the file exists takes it over: it adopts the jobs that are
+ * still running through pidfd_open, so they show in bglist, keep their
+ * timeout and are reported when they end, and reports the ones that ended
+ * in the meantime. Exit statuses of adopted jobs are not known.
+ *
+ * One shell at a time owns the file, by an flock held while it runs.
+ * Output that is captured (bgcapture) or measured (pipestat) goes through
+ * the shell, so those jobs end with it regardless.
+ */
+typedef struct job_slot {
+    uint32_t used;                      // set last when a job is added, cleared when it ends
+    int32_t nstages;
+    int32_t pids[JOBTABLE_STAGES];
+    uint64_t starts[JOBTABLE_STAGES];   // start times from /proc, to tell a reused pid
+    int64_t seconds;                    // when the job was started
+    int32_t timeout;                    // its time limit, 0 for none
+    char line[JOBTABLE_LINE];
+} job_slot_t;
+
+typedef struct job_table {
+    char magic[8];
+    int32_t owner;                      // pid of the shell keeping it
+    uint32_t nslots;
+    job_slot_t slots[JOBTABLE_SLOTS];
+} job_table_t;
+
+/*
+ * At startup: if a job table exists, take it over and adopt its jobs into
+ * bgList.
+ */
+void jobTableInit(List_t* bgList);
+
+/*
+ * Persist a job just added to bgList. Jobs of other lists (--listen
+ * clients) and of ( ... ) group processes are left out.
+ */
+void jobTableAdd(List_t* bgList, bgentry_t* entry);
+
+/*
+ * The job has ended; forget it.
+ */
+void jobTableRemove(bgentry_t* entry);
+
+/*
+ * Report the adopted jobs that have ended since the last call. Adopted
+ * jobs are not children of this shell, so waitpid never sees them.
+ */
+void jobTableReap(List_t* bgList);
+
+/*
+ * On exit: take the persisted jobs out of bgList without killing them. The
+ * rest are left to deleteList.
+ */
+void jobTableDetach(List_t* bgList);
+
+/*
+ * The bgpersist builtin: `bgpersist on|off`, or the current state.
+ */
+void bgpersistCommand(job_info* job, List_t* bgList);
+
+/*
+ * Let go of the table, and with it the lock. A ( ... ) group's process does
+ * this first, so that it does not hold the lock after the shell is gone.
+ */
+void jobTableClose();
+
+/*
+ * In a ( ... ) group's process (after eventForget): let go of the table and
+ * close this process's copies of the adopted jobs' pidfds.
+ */
+void jobTableForget();
+
+#endif
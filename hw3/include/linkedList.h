@@ -57,6 +57,35 @@ void insertInOrder(List_t* list, void* valref);
 void* removeFront(List_t* list);
 void removeByPID(List_t* list, pid_t pid);
 
+/*
+ * Take the entry of pid out of the list without printing or freeing it.
+ * @return the entry, or NULL if pid is not in the list
+ */
+bgentry_t* unlinkByPID(List_t* list, pid_t pid);
+
+/*
+ * Free an entry and everything it owns (job, capture, options, pids).
+ */
+void freeBGEntry(bgentry_t* entry);
+
+/*
+ * Find the background job that pid belongs to, as any stage of it.
+ * @return the entry, or NULL if pid is not a tracked background process
+ */
+bgentry_t* findByPID(List_t* list, pid_t pid);
+
+/*
+ * Record that stage pid of entry has been reaped.
+ * @return the number of stages of entry still running
+ */
+int stageReaped(bgentry_t* entry, pid_t pid);
+
+/*
+ * In a forked child that carries on as a shell: empty its copy of the list
+ * without killing or reporting the jobs, which are still the parent's.
+ */
+void forgetList(List_t* list);
+
 /* 
  * Free all nodes from the linkedList
  *
@@ -78,6 +107,13 @@ int bgentryComparator(const  void* bg1, const void* bg2);
 
 bgentry_t* createBGEntry(job_info *job, pid_t pid, time_t seconds);
 
+/*
+ * A job that only has a command line, for a background job that was not
+ * parsed by validate_input (a ( ... ) group, or one adopted from an earlier
+ * shell), so that bglist and the termination message can show it.
+ */
+job_info* createLineJob(const char* line);
+
 void printAscii();
 
 #endif
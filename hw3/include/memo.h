@@ -0,0 +1,59 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "icssh.h"
+#include "jobopts.h"
+#include <stdint.h>
+
+#define MEMO_DIR "53shell/memo"                 // under $XDG_CACHE_HOME, else $HOME/.cache
+#define MEMO_MAGIC "53MEMO1"
+#define MEMO_MAX_DEFAULT (256LL * 1024 * 1024)  // bytes the store may hold
+#define MEMO_ENV_DEFAULT "PATH LANG LC_ALL TZ"  // variables in the key unless $MEMO_ENV names others
+
+/*
+ * `memo cmd args` runs cmd once and replays its stdout, stderr and exit
+ * status on later runs whose inputs are the same, without spawning it.
+ *
+ * The key is a 128-bit hash of the working directory, argv, the variables
+ * named in $MEMO_ENV, and the device, inode, size and mtime of the program,
+ * of the < file, and of every argument that names an existing file. Without
+ * a < file the command reads /dev/null, since the shell's stdin is not
+ * part of the key. Each entry is one file in the store named by its key,
+ * written to a temporary file and renamed into place, so shells can share
+ * the store. Outputs are kept as a sequence of chunks so stdout and stderr
+ * replay in their original order:
+ *
+ *     memo_header_t
+ *     memo_chunk_t, data    (repeated)
+ *
+ * A hit bumps the entry's mtime; when the store outgrows its limit the
+ * entries used longest ago are removed. Runs that are killed or time out,
+ * and outputs larger than a quarter of the limit, are not kept.
+ */
+typedef struct memo_header {
+    char magic[8];
+    int32_t status;     // wait status of the run
+    uint32_t reserved;
+    uint64_t runNs;     // how long the run took, i.e. what a hit saves
+    uint64_t outBytes;
+    uint64_t errBytes;
+} memo_header_t;
+
+typedef struct memo_chunk {
+    uint32_t fd;        // STDOUT_FILENO or STDERR_FILENO
+    uint32_t len;
+} memo_chunk_t;
+
+/*
+ * Run the (single, foreground) process of job through the store.
+ * @return its wait status, cached or fresh
+ */
+int memoRun(job_info* job, char* line, job_opts_t* opts);
+
+/*
+ * The memo builtin: `memo` prints hit/miss statistics and the store size,
+ * `memo -m <bytes>` sets the size limit, `memo -c` empties the store.
+ */
+void memoCommand(job_info* job);
+
+#endif
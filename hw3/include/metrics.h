@@ -0,0 +1,100 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define METRICS_MAGIC "53METR1"
+#define METRICS_VERSION 1
+#define METRICS_BUCKETS 32      // latency histograms: bucket i counts [2^i, 2^(i+1)) us, 0 all below 2 us
+
+/*
+ * Live counters of a shell started with `--metrics <file>`, in a page that
+ * other processes map read-only (see tools/53metrics.c). The layout is part
+ * of the format; fields are only ever appended, with a new version.
+ *
+ * The shell's main loop is the only writer of every field but execFailures,
+ * so updates are a plain load and a relaxed store, with no lock and no
+ * atomic read-modify-write. Each field is 8 bytes and aligned, so a reader
+ * never sees a torn value, though fields read one after another may come
+ * from different moments. execFailures is bumped by children that failed
+ * to exec, atomically. A ( ... ) group's process stops writing when it
+ * forks, so what it runs is not counted.
+ */
+typedef struct metrics_page {
+    char magic[8];
+    uint32_t version;           // stored last, once the page is ready
+    int32_t pid;                // of the shell
+    uint64_t startNs;           // CLOCK_REALTIME when the page was created
+    uint64_t spawned;           // processes forked
+    uint64_t spawnNs;           // total time fork took in the shell
+    uint64_t bgActive;          // background jobs in bglist
+    uint64_t execFailures;
+    uint64_t reaped;            // background processes reaped
+    uint64_t reapLagNs;         // total time from their SIGCHLD to the reap
+    uint64_t reapLagMaxNs;
+    uint64_t lines;             // pipelines parsed
+    uint64_t parseNs;           // total time spent parsing them
+    uint64_t pipeBytes;         // through pipes measured by pipestat
+    uint64_t spawnHist[METRICS_BUCKETS];    // how long fork took in the shell
+    uint64_t parseHist[METRICS_BUCKETS];    // how long a line took to parse
+} metrics_page_t;
+
+extern metrics_page_t* metrics;
+
+// single-writer update: no lock prefix, but never torn for a reader
+#define METRIC_ADD(field, n)                                                         \
+    do {                                                                             \
+        if (metrics != NULL)                                                         \
+            __atomic_store_n(&metrics->field, metrics->field + (n), __ATOMIC_RELAXED); \
+    } while (0)
+
+#define METRIC_SET(field, v)                                                         \
+    do {                                                                             \
+        if (metrics != NULL)                                                         \
+            __atomic_store_n(&metrics->field, (v), __ATOMIC_RELAXED);                \
+    } while (0)
+
+/*
+ * Create the page at path and start counting.
+ * @return 0 on success, -1 on error
+ */
+int metricsOpen(const char* path);
+
+/*
+ * Stop counting; in a ( ... ) group's process, so the shell stays the only
+ * writer.
+ */
+void metricsClose();
+
+/*
+ * CLOCK_MONOTONIC nanoseconds, or 0 while metrics are off, to pass to the
+ * functions below once the measured step is done.
+ */
+uint64_t metricsNow();
+
+void metricsSpawned(uint64_t start);
+void metricsParsed(uint64_t start);
+
+/*
+ * A child failed to exec. Called in the child.
+ */
+void metricsExecFailed();
+
+/*
+ * From the SIGCHLD handler: the time the oldest unreaped child ended.
+ * Async-signal-safe.
+ */
+void metricsSigchld();
+
+/*
+ * A background process was reaped, after the SIGCHLD that announced it.
+ */
+void metricsReaped();
+
+/*
+ * Every process that SIGCHLD announced has been reaped.
+ */
+void metricsReapDone();
+
+#endif
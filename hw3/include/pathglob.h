@@ -0,0 +1,33 @@
+#ifndef PATHGLOB_H
+#define PATHGLOB_H
+
+#include "icssh.h"
+
+#define GLOB_DENTS_BUF (256 * 1024)   // bytes per getdents64 batch
+#define GLOB_CACHE_MAX 512            // directory listings kept before the cache is flushed
+
+extern int globCacheLines;    // keep listings across lines, revalidated by mtime
+
+/*
+ * Expand *, ?, [...] and ** in every argument of every process of job.
+ * Words without matches are left as they are. Matching strings live in the
+ * per-line arena; argv arrays that change are replaced (the parser's
+ * strings are never freed here).
+ * @return number of words that were expanded
+ */
+int expandJob(job_info* job);
+
+/*
+ * Expand one pattern.
+ * @param matches set to a sorted, arena-allocated array of the matches
+ * @return number of matches
+ */
+int globWord(const char* pattern, char*** matches);
+
+/*
+ * Start a new line: drop the per-line listings (all of them unless
+ * globCacheLines is set) and the arena.
+ */
+void globReset();
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PIPESTAT_H
+#define PIPESTAT_H
+
+#include "icssh.h"
+
+#define RELAY_CHUNK (1024 * 1024)   // most bytes moved by one splice
+
+extern int pipeSize;          // F_SETPIPE_SZ for pipeline pipes, 0 for the kernel default
+extern int pipeStatEnabled;   // instrument every pipeline
+
+/*
+ * One link of an instrumented pipeline. Instead of one pipe between two
+ * stages there are two; the shell splices from the upstream one into the
+ * downstream one on the event loop, counting bytes and the time spent
+ * waiting on either side.
+ *
+ * emptyNs - nothing to relay: the downstream stage waited on the upstream
+ * fullNs - the downstream pipe was full: the upstream stage waited on the
+ *          downstream
+ */
+typedef struct pipelink {
+    int in;                     // read end of the upstream pipe, -1 once done
+    int out;                    // write end of the downstream pipe
+    int state;
+    unsigned long long since;   // when the link entered state
+    unsigned long long start;
+    unsigned long long end;     // 0 while the link is open
+    unsigned long long bytes;
+    unsigned long long emptyNs;
+    unsigned long long fullNs;
+} pipelink_t;
+
+typedef struct pipestat {
+    char** names;               // command of every stage
+    int nlinks;
+    pipelink_t links[];
+} pipestat_t;
+
+/*
+ * Set the capacity of the pipe fd belongs to; size 0 leaves it alone.
+ * @return the new capacity, 0 if unchanged, -1 on error
+ */
+int pipeResize(int fd, int size);
+
+/*
+ * Make size the capacity of every pipeline pipe from now on (0 for the
+ * default), rounded up as the kernel does. Tried on a scratch pipe first.
+ * @return 0 on success, -1 if the kernel refuses the size
+ */
+int setPipeSize(int size);
+
+/*
+ * Instrumentation for the pipes of job.
+ */
+pipestat_t* pipestatOpen(job_info* job);
+
+/*
+ * Create the relayed link after stage k. fd[1] is for stage k to write to,
+ * fd[0] for stage k + 1 to read from, just like pipe(fd). Both pipes get
+ * capacity size (0 for the default).
+ * @return 0 on success, -1 on error
+ */
+int pipestatLink(pipestat_t* stats, int k, int fd[2], int size);
+
+/*
+ * Move whatever is left once every stage has exited, and close the links.
+ */
+void pipestatFinish(pipestat_t* stats);
+
+/*
+ * Print bytes, throughput and waiting time of every link, and the stage
+ * that held the pipeline up the most.
+ */
+void pipestatReport(pipestat_t* stats, FILE* out);
+
+void pipestatFree(pipestat_t* stats);
+
+#endif
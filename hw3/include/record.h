@@ -0,0 +1,58 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#define RECORD_VERSION 1
+
+/*
+ * Session record and replay.
+ *
+ * 53shell --record <file> writes every input line and what became of it as
+ * text, with nanoseconds relative to the start of the session:
+ *
+ *     # 53shell record 1
+ *     L <ns> <line>                a line was read
+ *     E <ns> <event> <pid> <arg>   a job lifecycle event (see trace.h)
+ *     D <ns> <status>              the shell was ready for the next line;
+ *                                  status is the last foreground exit status
+ *
+ * 53shell --replay <file> [--paced] reads its lines from the L records of a
+ * recording instead of the terminal, as fast as possible or at the recorded
+ * pacing. Both can be combined, so that two builds replaying one session
+ * produce two recordings for tools/53cmp to compare.
+ */
+
+/*
+ * Start recording to path. Turns on job event tracing.
+ * @return 0 on success, -1 if path cannot be written
+ */
+int recordOpen(const char* path);
+
+/*
+ * Take the input lines from the recording at path.
+ * @return 0 on success, -1 if path cannot be read
+ */
+int replayOpen(const char* path, int paced);
+
+/*
+ * @return 1 if lines come from a recording
+ */
+int replayActive();
+
+/*
+ * Finish the previous line with its exit status, then return the next input
+ * line (malloc'd) from the replay or from readline, or NULL at the end of
+ * input. Records both when recording.
+ */
+char* recordNextLine(const char* prompt, int lastStatus);
+
+/*
+ * The line read last is done; record its events and status.
+ */
+void recordLineDone(int status);
+
+/*
+ * Finish the recording and close the files.
+ */
+void recordClose();
+
+#endif
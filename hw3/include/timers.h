@@ -0,0 +1,35 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <sys/types.h>
+
+#define TIMEOUT_GRACE 5      // seconds between SIGTERM and SIGKILL
+#define TIMEOUT_STATUS 124   // exit status reported for a job that timed out
+
+extern int bgTimeout;        // default limit for background jobs, 0 for none
+
+/*
+ * Absolute deadline (CLOCK_MONOTONIC nanoseconds) seconds from now.
+ */
+unsigned long long timerDeadline(int seconds);
+
+/*
+ * Watch pid: at deadline it is sent SIGTERM, and SIGKILL TIMEOUT_GRACE
+ * seconds later if it is still around. All deadlines share one timerfd.
+ * @param seconds the limit the deadline was derived from, for reporting
+ */
+void timerArm(pid_t pid, unsigned long long deadline, int seconds);
+
+/*
+ * Forget pid once it has been reaped.
+ * @return the limit in seconds if pid was terminated for timing out, else 0
+ */
+int timerCancel(pid_t pid);
+
+/*
+ * In a forked child that carries on as a shell (after eventForget): drop the
+ * parent's deadlines and its copy of the timerfd.
+ */
+void timerForget();
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define TRACE_CAPACITY 65536          // events kept in the ring, a power of 2
+#define TRACE_MAGIC "53TRACE"
+#define TRACE_VERSION 1
+
+/*
+ * Job lifecycle events. The numeric values are part of the binary format.
+ */
+typedef enum trace_type {
+    TRACE_PARSE = 1,    // a line was parsed; arg is the number of processes
+    TRACE_SPAWN,        // a child was forked; arg is its pipeline stage
+    TRACE_EXEC,         // the child is about to exec
+    TRACE_EXEC_ERR,     // exec failed (EXEC_ERR)
+    TRACE_RD_ERR,       // redirection failed (RD_ERR)
+    TRACE_EXIT,         // a child was reaped; arg is its wait status
+    TRACE_BG_TERM,      // a background job was reported as terminated (BG_TERM)
+    TRACE_SIGCHLD,      // SIGCHLD was delivered to the shell
+    TRACE_MEMO_HIT,     // a memo run was replayed from the store; arg is its wait status
+} trace_type_t;
+
+/*
+ * One fixed-size record. seq is written last, so a reader can tell a slot
+ * that is still being filled in from a complete one.
+ */
+typedef struct trace_event {
+    uint64_t ns;        // CLOCK_REALTIME nanoseconds
+    uint32_t seq;       // 1 + index of the event, 0 while being written
+    uint32_t type;
+    int32_t pid;
+    int32_t arg;
+} trace_event_t;
+
+/*
+ * Header of a binary trace file, followed by count trace_event_t records.
+ */
+typedef struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+} trace_file_header_t;
+
+/*
+ * Shared ring the events go to. It is mapped MAP_SHARED before any child is
+ * forked, so events recorded by children (exec, exec errors) land in it too.
+ */
+typedef struct trace_ring {
+    uint64_t head;      // index of the next event, advanced atomically
+    uint64_t flushed;   // index of the first event not yet flushed
+    trace_event_t events[TRACE_CAPACITY];
+} trace_ring_t;
+
+extern trace_ring_t* traceRing;
+
+/*
+ * Record an event. Costs a load and a branch while tracing is off.
+ * Async-signal-safe, so it may be used from the SIGCHLD handler.
+ */
+#define TRACE(type, pid, arg)                      \
+    do {                                           \
+        if (traceRing != NULL)                     \
+            traceRecord((type), (pid), (arg));     \
+    } while (0)
+
+void traceRecord(trace_type_t type, pid_t pid, int arg);
+
+/*
+ * Start or stop recording. The ring is mapped on the first start and kept
+ * afterwards, so events can still be flushed once tracing is off.
+ * @return 0 on success, -1 on error
+ */
+int traceStart();
+void traceStop();
+
+/*
+ * Write the events recorded since the last flush to fd, as JSON lines or
+ * in the binary format.
+ * @return number of events written, -1 on error
+ */
+int traceFlush(int fd, int binary);
+
+/*
+ * @return the name of an event type, as used in the JSON output
+ */
+const char* traceName(uint32_t type);
+
+/*
+ * Format one event as a JSON line (including the newline) into buf.
+ */
+int traceFormat(const trace_event_t* ev, char* buf, size_t size);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include "icssh.h"
+
+/*
+ * Shell variables. The store is seeded lazily from environ the first time
+ * it is used, so a shell that never touches variables pays nothing.
+ */
+
+/*
+ * @return the value of name, or NULL if it is not set
+ */
+char* varGet(const char* name);
+
+/*
+ * Set name to value (copied). An exported variable is passed to children.
+ * @return 0 on success, -1 if name is not a valid identifier
+ */
+int varSet(const char* name, const char* value, int exported);
+
+/*
+ * Mark an existing variable as exported.
+ * @return 0 on success, -1 if it is not set
+ */
+int varExport(const char* name);
+
+void varUnset(const char* name);
+
+/*
+ * The environment for exec: built from the exported variables only when
+ * one of them changed since the last call, otherwise the cached array is
+ * returned. Until the store is first modified this is environ itself.
+ */
+char** varsEnviron();
+
+/*
+ * Print every exported variable as `export NAME=value`.
+ */
+void varsPrint();
+
+/*
+ * Replace $NAME and ${NAME} in every argument and redirection file name of
+ * job. Unset variables expand to the empty string. Expanded words live in
+ * the per-line arena.
+ * @return number of words that changed
+ */
+int expandVars(job_info* job);
+
+/*
+ * The export and unset builtins.
+ */
+void exportCommand(proc_info* proc);
+void unsetCommand(proc_info* proc);
+
+#endif
@@ -0,0 +1,66 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK (64 * 1024)
+
+typedef struct chunk {
+    struct chunk* next;
+    size_t used;
+    size_t size;
+    char data[];
+} chunk_t;
+
+static chunk_t* chunks = NULL;  // newest first; allocations come from the head
+
+void* arenaAlloc(size_t size) {
+    chunk_t* c = chunks;
+
+    size = (size + 15) & ~(size_t)15;
+    if (c == NULL || c->size - c->used < size) {
+        size_t want = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        c = malloc(sizeof(chunk_t) + want);
+        if (c == NULL) {
+            return NULL;
+        }
+        c->used = 0;
+        c->size = want;
+        // an oversized chunk goes behind the head so the head keeps its free space
+        if (size > ARENA_CHUNK && chunks != NULL) {
+            c->next = chunks->next;
+            chunks->next = c;
+        } else {
+            c->next = chunks;
+            chunks = c;
+        }
+    }
+    void* p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+char* arenaStrndup(const char* s, size_t len) {
+    char* p = arenaAlloc(len + 1);
+    if (p != NULL) {
+        memcpy(p, s, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+void arenaReset() {
+    // keep one chunk around; most lines fit in it
+    while (chunks != NULL && chunks->next != NULL) {
+        chunk_t* next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    if (chunks != NULL) {
+        if (chunks->size > ARENA_CHUNK) {
+            free(chunks);
+            chunks = NULL;
+        } else {
+            chunks->used = 0;
+        }
+    }
+}
@@ -0,0 +1,199 @@
+#include "bgtop.h"
+#include "events.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROC_BUF 1024
+#define SAMPLE_MIN_NS 100000000ULL  // shorter gaps are below clock tick resolution
+
+/*
+ * Per-process sampling state. The /proc files stay open between samples
+ * and are re-read with pread, so a refresh costs two syscalls per stage.
+ */
+typedef struct sample {
+    pid_t pid;
+    int statFd;
+    int statmFd;
+    unsigned long long ticks;   // utime + stime at the last sample
+    unsigned long long when;    // CLOCK_BOOTTIME ns of the last sample
+    int seen;                   // still tracked as of the current pass
+} sample_t;
+
+static sample_t* samples = NULL;
+static int nsamples = 0;
+static int capSamples = 0;
+
+static unsigned long long bootNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void closeSample(sample_t* s) {
+    close(s->statFd);
+    close(s->statmFd);
+    *s = samples[--nsamples];
+}
+
+static sample_t* findSample(pid_t pid) {
+    char path[64];
+    int i;
+
+    for (i = 0; i < nsamples; i++) {
+        if (samples[i].pid == pid) {
+            return &samples[i];
+        }
+    }
+
+    if (nsamples == capSamples) {
+        capSamples = capSamples ? capSamples * 2 : 16;
+        samples = realloc(samples, capSamples * sizeof(sample_t));
+    }
+    sample_t* s = &samples[nsamples];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((s->statFd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    if ((s->statmFd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        close(s->statFd);
+        return NULL;
+    }
+    s->pid = pid;
+    s->ticks = 0;
+    s->when = 0;
+    nsamples++;
+    return s;
+}
+
+static ssize_t readProc(int fd, char* buf) {
+    ssize_t n = pread(fd, buf, PROC_BUF - 1, 0);
+    if (n >= 0) {
+        buf[n] = '\0';
+    }
+    return n;
+}
+
+// sample one stage and print its row; returns 1 if the process still runs,
+// 0 if it has exited and waits to be reaped, -1 if it is gone
+static int printStage(pid_t pid, char* line) {
+    char buf[PROC_BUF];
+    char comm[32];
+    char state;
+    unsigned long long utime, stime, start, now, ticks;
+    unsigned long size, resident;
+    double cpu;
+    long hz = sysconf(_SC_CLK_TCK);
+    sample_t* s = findSample(pid);
+
+    if (s == NULL || readProc(s->statFd, buf) <= 0) {
+        return -1;
+    }
+    s->seen = 1;
+
+    // comm may contain spaces and parentheses; the fields resume after the last ')'
+    char* open = strchr(buf, '(');
+    char* close = strrchr(buf, ')');
+    if (open == NULL || close == NULL) {
+        return -1;
+    }
+    snprintf(comm, sizeof(comm), "%.*s", (int)(close - open - 1), open + 1);
+    if (sscanf(close + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu",
+               &state, &utime, &stime, &start) != 4) {
+        return -1;
+    }
+    if (readProc(s->statmFd, buf) <= 0 || sscanf(buf, "%lu %lu", &size, &resident) != 2) {
+        return -1;
+    }
+
+    // CPU% since the last sample, or averaged over the lifetime when there is
+    // no earlier sample recent enough to measure against
+    now = bootNs();
+    ticks = utime + stime;
+    if (s->when == 0 || now - s->when < SAMPLE_MIN_NS) {
+        double alive = now / 1e9 - (double)start / hz;
+        cpu = alive > 0 ? 100.0 * ticks / hz / alive : 0;
+    } else {
+        double elapsed = (now - s->when) / 1e9;
+        cpu = elapsed > 0 ? 100.0 * (ticks - s->ticks) / hz / elapsed : 0;
+    }
+    if (s->when == 0 || now - s->when >= SAMPLE_MIN_NS) {
+        s->ticks = ticks;
+        s->when = now;
+    }
+
+    printf("%-8d %c %6.1f %10lu  %-16s %s\n", pid, state, cpu,
+           resident * (sysconf(_SC_PAGESIZE) / 1024), comm, line);
+    return state != 'Z' && state != 'X';
+}
+
+// print one table; returns the number of live processes shown
+static int printPass(List_t* bgList) {
+    node_t* node;
+    int i, shown = 0;
+
+    for (i = 0; i < nsamples; i++) {
+        samples[i].seen = 0;
+    }
+
+    printf("%-8s %c %6s %10s  %-16s %s\n", "PID", 'S', "%CPU", "RSS(KiB)", "COMM", "JOB");
+    for (node = bgList->head; node != NULL; node = node->next) {
+        bgentry_t* entry = (bgentry_t*)node->value;
+        if (entry->pids == NULL) {
+            shown += printStage(entry->pid, entry->job->line) == 1;
+            continue;
+        }
+        // the job line goes on its first stage shown; later ones show "|"
+        char* label = entry->job->line;
+        for (i = 0; i < entry->nstages; i++) {
+            int live = entry->pids[i] > 0 ? printStage(entry->pids[i], label) : -1;
+            if (live != -1) {
+                label = "|";
+                shown += live;
+            }
+        }
+    }
+    fflush(stdout);
+
+    // drop the fds of processes that were reaped since the last pass
+    for (i = nsamples - 1; i >= 0; i--) {
+        if (!samples[i].seen) {
+            closeSample(&samples[i]);
+        }
+    }
+    return shown;
+}
+
+void bgtop(List_t* bgList, int interval, int count) {
+    int stdinFd = isatty(STDIN_FILENO) ? STDIN_FILENO : -1;
+    int pass = 0;
+
+    if (printPass(bgList) == 0 || interval <= 0) {
+        return;
+    }
+    // keep servicing the event loop between refreshes; a line ends it early
+    while (count == 0 || ++pass < count) {
+        unsigned long long until = bootNs() + interval * 1000000000ULL;
+        unsigned long long t;
+        while ((t = bootNs()) < until) {
+            if (eventPollWith(stdinFd, (until - t) / 1000000 + 1)) {
+                return;
+            }
+        }
+        printf("\n");
+        // stop once every job has exited
+        if (printPass(bgList) == 0) {
+            return;
+        }
+    }
+}
+
+void bgtopClose() {
+    while (nsamples > 0) {
+        closeSample(&samples[nsamples - 1]);
+    }
+    free(samples);
+    samples = NULL;
+    capSamples = 0;
+}
@@ -0,0 +1,285 @@
+#include "capture.h"
+#include "events.h"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define CAPTURE_MIN_RING 4096
+#define CAPTURE_READ 16384
+
+int captureEnabled = 0;
+
+static size_t captureUsed = 0;          // bytes held by every ring, live or retired
+static capture_t* retiredHead = NULL;   // oldest retired capture, evicted first
+static capture_t* retiredTail = NULL;
+
+static void freeCapture(capture_t* cap) {
+    int i;
+    for (i = 0; i < 2; i++) {
+        captureUsed -= cap->rings[i].cap;
+        free(cap->rings[i].data);
+    }
+    free(cap->line);
+    free(cap);
+}
+
+// drop the oldest retired capture; returns 0 if there was none
+static int evictRetired() {
+    capture_t* victim = retiredHead;
+    if (victim == NULL) {
+        return 0;
+    }
+    retiredHead = victim->next;
+    if (retiredHead == NULL) {
+        retiredTail = NULL;
+    }
+    freeCapture(victim);
+    return 1;
+}
+
+// grow ring so that len more bytes fit without wrapping, within both caps
+static void ringGrow(ringbuf_t* ring, size_t len) {
+    size_t want = ring->cap ? ring->cap : CAPTURE_MIN_RING;
+    char* grown;
+
+    // a ring that has wrapped keeps its size; its data is no longer linear
+    if (ring->total + len <= ring->cap || ring->total > ring->cap || ring->cap >= CAPTURE_JOB_MAX) {
+        return;
+    }
+    while (want < ring->total + len && want < CAPTURE_JOB_MAX) {
+        want *= 2;
+    }
+    if (want > CAPTURE_JOB_MAX) {
+        want = CAPTURE_JOB_MAX;
+    }
+    while (captureUsed + (want - ring->cap) > CAPTURE_TOTAL_MAX && evictRetired())
+        ;
+    if (captureUsed + (want - ring->cap) > CAPTURE_TOTAL_MAX) {
+        want = ring->cap + (CAPTURE_TOTAL_MAX - captureUsed);
+    }
+    if (want <= ring->cap || (grown = realloc(ring->data, want)) == NULL) {
+        return;
+    }
+    captureUsed += want - ring->cap;
+    ring->data = grown;
+    ring->cap = want;
+}
+
+static void ringWrite(ringbuf_t* ring, const char* buf, size_t len) {
+    ringGrow(ring, len);
+    if (ring->cap == 0) {   // global budget exhausted before this ring got any
+        ring->total += len;
+        return;
+    }
+    if (len > ring->cap) {  // only the tail can survive
+        ring->total += len - ring->cap;
+        buf += len - ring->cap;
+        len = ring->cap;
+    }
+    while (len > 0) {
+        size_t pos = ring->total % ring->cap;
+        size_t n = ring->cap - pos < len ? ring->cap - pos : len;
+        memcpy(ring->data + pos, buf, n);
+        ring->total += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+// write the bytes after offset from that are still in the ring; returns new offset
+static unsigned long long ringShow(ringbuf_t* ring, unsigned long long from, int fd) {
+    unsigned long long oldest = ring->total > ring->cap ? ring->total - ring->cap : 0;
+
+    if (from < oldest) {
+        from = oldest;
+    }
+    while (from < ring->total) {
+        size_t pos = from % ring->cap;
+        size_t n = ring->cap - pos;
+        if (n > ring->total - from) {
+            n = ring->total - from;
+        }
+        if (write(fd, ring->data + pos, n) < 0) {
+            break;
+        }
+        from += n;
+    }
+    return ring->total;
+}
+
+static void closeReader(capture_t* cap, int i) {
+    eventRemove(cap->rfds[i]);
+    close(cap->rfds[i]);
+    cap->rfds[i] = -1;
+}
+
+// read everything currently in the pipe; closes it at EOF
+static void drainStream(capture_t* cap, int i) {
+    char buf[CAPTURE_READ];
+    ssize_t n;
+
+    while (cap->rfds[i] != -1) {
+        n = read(cap->rfds[i], buf, sizeof(buf));
+        if (n > 0) {
+            ringWrite(&cap->rings[i], buf, n);
+        } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+            closeReader(cap, i);
+        } else if (errno == EAGAIN) {
+            break;
+        }
+    }
+}
+
+static void captureReady(int fd, unsigned int events, void* arg) {
+    capture_t* cap = (capture_t*)arg;
+    drainStream(cap, fd == cap->rfds[CAPTURE_OUT] ? CAPTURE_OUT : CAPTURE_ERR);
+}
+
+capture_t* captureOpen(job_info* job) {
+    int fds[2][2];
+    int i;
+
+    if (!captureEnabled) {
+        return NULL;
+    }
+    if (pipe2(fds[0], O_CLOEXEC) == -1) {
+        return NULL;
+    }
+    if (pipe2(fds[1], O_CLOEXEC) == -1) {
+        close(fds[0][0]);
+        close(fds[0][1]);
+        return NULL;
+    }
+
+    capture_t* cap = calloc(1, sizeof(capture_t));
+    cap->line = strdup(job->line);
+    for (i = 0; i < 2; i++) {
+        cap->rfds[i] = fds[i][0];
+        cap->wfds[i] = fds[i][1];
+        fcntl(cap->rfds[i], F_SETFL, O_NONBLOCK);
+        eventAdd(cap->rfds[i], EPOLLIN, captureReady, cap);
+    }
+    return cap;
+}
+
+void captureChild(capture_t* cap, int withOut) {
+    if (withOut) {
+        dup2(cap->wfds[CAPTURE_OUT], STDOUT_FILENO);
+    }
+    dup2(cap->wfds[CAPTURE_ERR], STDERR_FILENO);
+}
+
+void captureForget(capture_t* cap) {
+    int i;
+
+    if (cap == NULL) {
+        return;
+    }
+    captureCloseWriters(cap);
+    for (i = 0; i < 2; i++) {
+        if (cap->rfds[i] != -1) {
+            closeReader(cap, i);
+        }
+    }
+    freeCapture(cap);
+}
+
+void captureCloseWriters(capture_t* cap) {
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (cap->wfds[i] != -1) {
+            close(cap->wfds[i]);
+            cap->wfds[i] = -1;
+        }
+    }
+}
+
+void captureRetire(capture_t* cap) {
+    int i;
+
+    if (cap == NULL) {
+        return;
+    }
+    captureCloseWriters(cap);
+    for (i = 0; i < 2; i++) {
+        drainStream(cap, i);
+        if (cap->rfds[i] != -1) {   // something outlived the job and holds the pipe
+            closeReader(cap, i);
+        }
+    }
+    if (cap->rings[CAPTURE_OUT].total == 0 && cap->rings[CAPTURE_ERR].total == 0) {
+        freeCapture(cap);
+        return;
+    }
+    cap->next = NULL;
+    if (retiredTail != NULL) {
+        retiredTail->next = cap;
+    } else {
+        retiredHead = cap;
+    }
+    retiredTail = cap;
+}
+
+static capture_t* unlinkRetired(pid_t pid) {
+    capture_t* prev = NULL;
+    capture_t* cap = retiredHead;
+
+    while (cap != NULL && cap->pid != pid) {
+        prev = cap;
+        cap = cap->next;
+    }
+    if (cap == NULL) {
+        return NULL;
+    }
+    if (prev != NULL) {
+        prev->next = cap->next;
+    } else {
+        retiredHead = cap->next;
+    }
+    if (retiredTail == cap) {
+        retiredTail = prev;
+    }
+    return cap;
+}
+
+int captureShow(List_t* bgList, pid_t pid, int follow) {
+    unsigned long long from[2] = {0, 0};
+    capture_t* cap = NULL;
+    node_t* node;
+
+    for (node = bgList->head; node != NULL; node = node->next) {
+        bgentry_t* entry = (bgentry_t*)node->value;
+        if (entry->pid == pid) {
+            cap = entry->capture;
+            break;
+        }
+    }
+
+    // the job was already reaped: print what it left behind, then let it go
+    if (cap == NULL) {
+        if ((cap = unlinkRetired(pid)) == NULL) {
+            return -1;
+        }
+        fflush(stdout);
+        ringShow(&cap->rings[CAPTURE_OUT], 0, STDOUT_FILENO);
+        ringShow(&cap->rings[CAPTURE_ERR], 0, STDERR_FILENO);
+        freeCapture(cap);
+        return 0;
+    }
+
+    fflush(stdout);
+    do {
+        from[CAPTURE_OUT] = ringShow(&cap->rings[CAPTURE_OUT], from[CAPTURE_OUT], STDOUT_FILENO);
+        from[CAPTURE_ERR] = ringShow(&cap->rings[CAPTURE_ERR], from[CAPTURE_ERR], STDERR_FILENO);
+        if (!follow || (cap->rfds[CAPTURE_OUT] == -1 && cap->rfds[CAPTURE_ERR] == -1)) {
+            break;
+        }
+        // only an interactive user can end a follow early by entering a line
+    } while (!eventPollWith(isatty(STDIN_FILENO) ? STDIN_FILENO : -1, -1));
+    return 0;
+}
+
+void captureFreeAll() {
+    while (evictRetired())
+        ;
+}
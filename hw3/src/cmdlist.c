@@ -0,0 +1,411 @@
+#include "cmdlist.h"
+#include "complete.h"
+#include "events.h"
+#include "helpers.h"
+#include "histfile.h"
+#include "jobtable.h"
+#include "metrics.h"
+#include "record.h"
+#include "timers.h"
+#include "trace.h"
+#include <ctype.h>
+
+typedef enum tok_type {
+    TOK_TEXT,
+    TOK_SEMI,
+    TOK_BG,
+    TOK_AND,
+    TOK_OR,
+    TOK_OPEN,
+    TOK_CLOSE,
+    TOK_END,
+} tok_type_t;
+
+typedef struct tok {
+    tok_type_t type;
+    int start;      // offset in the line
+    int len;
+} tok_t;
+
+typedef struct parser {
+    const char* line;
+    tok_t* toks;
+    int pos;
+    cmd_item_t* items;
+    int count;
+    int cap;
+} parser_t;
+
+static const char* tokNames[] = {
+    [TOK_TEXT] = "command", [TOK_SEMI] = "';'", [TOK_BG] = "'&'", [TOK_AND] = "'&&'",
+    [TOK_OR] = "'||'", [TOK_OPEN] = "'('", [TOK_CLOSE] = "')'", [TOK_END] = "end of line",
+};
+
+// builtins whose effect would be lost if they ran in a child process
+static const char* stateBuiltins[] = {
+    "bgcapture", "bgpersist", "bgtimeout", "cd", "exit", "export", "globcache", "memo", "pipesize",
+    "pipestat", "trace", "unset", NULL
+};
+
+static char* input = NULL;      // the line being run
+static cmd_item_t* items = NULL;
+static int nitems = 0;
+static int next = 0;            // item to consider next
+static int exitAt = -1;         // in a group's process: index of its CMD_GROUP_END
+static int lastStatus = 0;
+
+static void addTok(tok_t** toks, int* n, tok_type_t type, int start, int len) {
+    *toks = realloc(*toks, (*n + 1) * sizeof(tok_t));
+    (*toks)[*n] = (tok_t){type, start, len};
+    (*n)++;
+}
+
+// the text from start to end, if there is any besides blanks
+static void addText(tok_t** toks, int* n, const char* line, int start, int end) {
+    while (start < end && isspace((unsigned char)line[start])) {
+        start++;
+    }
+    while (end > start && isspace((unsigned char)line[end - 1])) {
+        end--;
+    }
+    if (end > start) {
+        addTok(toks, n, TOK_TEXT, start, end - start);
+    }
+}
+
+// split line at the list operators outside quotes; everything else is text
+static int lex(const char* line, tok_t** toks) {
+    int n = 0;
+    int text = 0;   // start of the pending text
+    int i = 0;
+
+    *toks = NULL;
+    while (line[i] != '\0') {
+        char c = line[i];
+        tok_type_t type;
+        int len = 1;
+
+        if (c == '\'' || c == '"') {
+            char* close = strchr(line + i + 1, c);
+            i = close != NULL ? close - line + 1 : (int)strlen(line);
+            continue;
+        }
+        if (c == '\\' && line[i + 1] != '\0') {
+            i += 2;
+            continue;
+        }
+        if (c == ';') {
+            type = TOK_SEMI;
+        } else if (c == '&' && line[i + 1] == '&') {
+            type = TOK_AND;
+            len = 2;
+        } else if (c == '&' && line[i + 1] != '>' && (i == 0 || line[i - 1] != '>')) {
+            type = TOK_BG;      // not part of a redirection such as 2>&1
+        } else if (c == '|' && line[i + 1] == '|') {
+            type = TOK_OR;
+            len = 2;
+        } else if (c == '(') {
+            type = TOK_OPEN;
+        } else if (c == ')') {
+            type = TOK_CLOSE;
+        } else {
+            i++;
+            continue;
+        }
+        addText(toks, &n, line, text, i);
+        addTok(toks, &n, type, i, len);
+        i += len;
+        text = i;
+    }
+    addText(toks, &n, line, text, i);
+    addTok(toks, &n, TOK_END, i, 0);
+    return n;
+}
+
+static tok_type_t peek(parser_t* p) {
+    return p->toks[p->pos].type;
+}
+
+static int syntaxError(parser_t* p) {
+    fprintf(stderr, LIST_ERR, tokNames[peek(p)]);
+    return -1;
+}
+
+static int addItem(parser_t* p, cmd_type_t type, cmd_link_t link, char* text) {
+    if (p->count == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 8;
+        p->items = realloc(p->items, p->cap * sizeof(cmd_item_t));
+    }
+    p->items[p->count] = (cmd_item_t){type, link, text, 0, 0, 0};
+    return p->count++;
+}
+
+static int isStateBuiltin(const char* text) {
+    size_t len = strcspn(text, " \t\n");
+    int i;
+
+    for (i = 0; stateBuiltins[i] != NULL; i++) {
+        if (strlen(stateBuiltins[i]) == len && strncmp(text, stateBuiltins[i], len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// close the group opened at item g, which spans the source from start to end
+static void endGroup(parser_t* p, int g, int start, int end) {
+    int i;
+
+    p->items[g].end = addItem(p, CMD_GROUP_END, CMD_SEQ, NULL);
+    p->items[g].text = strndup(p->line + start, end - start);
+    for (i = g + 1; i < p->items[g].end; i++) {
+        if (p->items[i].type == CMD_PIPELINE && isStateBuiltin(p->items[i].text)) {
+            p->items[g].fork = 1;
+        }
+    }
+}
+
+static int parseList(parser_t* p);
+
+// unit := pipeline | '(' list ')'
+static int parseUnit(parser_t* p, cmd_link_t link) {
+    tok_t* t = &p->toks[p->pos];
+    int g;
+
+    if (t->type == TOK_TEXT) {
+        addItem(p, CMD_PIPELINE, link, strndup(p->line + t->start, t->len));
+        p->pos++;
+        return 0;
+    }
+    if (t->type != TOK_OPEN) {
+        return syntaxError(p);
+    }
+    p->pos++;
+    g = addItem(p, CMD_GROUP, link, NULL);
+    if (parseList(p) == -1) {
+        return -1;
+    }
+    if (peek(p) != TOK_CLOSE) {
+        return syntaxError(p);
+    }
+    endGroup(p, g, t->start, p->toks[p->pos].start + 1);
+    p->pos++;
+    return 0;
+}
+
+// andor := unit (('&&' | '||') unit)*
+static int parseAndOr(parser_t* p) {
+    cmd_link_t link = CMD_SEQ;
+
+    while (parseUnit(p, link) == 0) {
+        if (peek(p) == TOK_AND) {
+            link = CMD_AND;
+        } else if (peek(p) == TOK_OR) {
+            link = CMD_OR;
+        } else {
+            return 0;
+        }
+        p->pos++;
+    }
+    return -1;
+}
+
+static void appendBg(cmd_item_t* item) {
+    char* text = malloc(strlen(item->text) + 3);
+    sprintf(text, "%s &", item->text);
+    free(item->text);
+    item->text = text;
+}
+
+// run the and-or list that starts at item first, source start to end, in the background
+static void background(parser_t* p, int first, int start, int end) {
+    cmd_item_t* unit = &p->items[first];
+    int i;
+
+    // a lone pipeline goes to the parser with its &, as always
+    if (unit->type == CMD_PIPELINE && first == p->count - 1) {
+        appendBg(unit);
+        return;
+    }
+    // a chain becomes a group of its own
+    if (unit->type != CMD_GROUP || unit->end != p->count - 1) {
+        addItem(p, CMD_PIPELINE, CMD_SEQ, NULL);
+        memmove(&p->items[first + 1], &p->items[first], (p->count - 1 - first) * sizeof(cmd_item_t));
+        for (i = first + 1; i < p->count; i++) {
+            if (p->items[i].type == CMD_GROUP) {
+                p->items[i].end++;
+            }
+        }
+        p->items[first] = (cmd_item_t){CMD_GROUP, CMD_SEQ, NULL, 0, 0, 0};
+        endGroup(p, first, start, end);
+        unit = &p->items[first];
+    }
+    unit->fork = 1;
+    unit->bg = 1;
+    appendBg(unit);
+}
+
+// list := andor ((';' | '&') andor)* [';' | '&'], up to ')' or the end
+static int parseList(parser_t* p) {
+    for (;;) {
+        int first = p->count;
+        int start = p->toks[p->pos].start;
+
+        if (parseAndOr(p) == -1) {
+            return -1;
+        }
+        if (peek(p) == TOK_BG) {
+            tok_t* last = &p->toks[p->pos - 1];
+            background(p, first, start, last->start + last->len);
+        } else if (peek(p) != TOK_SEMI) {
+            return peek(p) == TOK_END || peek(p) == TOK_CLOSE ? 0 : syntaxError(p);
+        }
+        p->pos++;
+        if (peek(p) == TOK_END || peek(p) == TOK_CLOSE) {
+            return 0;
+        }
+    }
+}
+
+static void freeItems() {
+    int i;
+
+    for (i = 0; i < nitems; i++) {
+        free(items[i].text);
+    }
+    free(items);
+    items = NULL;
+    nitems = 0;
+    next = 0;
+    free(input);
+    input = NULL;
+}
+
+// make line the current list; -1 after a syntax error
+static int parseLine(char* line) {
+    parser_t p;
+    int ntoks;
+
+    memset(&p, 0, sizeof(p));
+    p.line = line;
+    ntoks = lex(line, &p.toks);
+    input = line;
+
+    // a plain pipeline (or nothing) is passed on untouched
+    if (ntoks == 1 || (ntoks == 2 && p.toks[0].type == TOK_TEXT) ||
+        (ntoks == 3 && p.toks[0].type == TOK_TEXT && p.toks[1].type == TOK_BG)) {
+        free(p.toks);
+        items = malloc(sizeof(cmd_item_t));
+        items[0] = (cmd_item_t){CMD_PIPELINE, CMD_SEQ, strdup(line), 0, 0, 0};
+        nitems = 1;
+        return 0;
+    }
+
+    int result = parseList(&p);
+    if (result == 0 && peek(&p) != TOK_END) {
+        result = syntaxError(&p);   // a ')' without its '('
+    }
+    free(p.toks);
+    items = p.items;
+    nitems = p.count;
+    if (result == -1) {
+        freeItems();
+    }
+    return result;
+}
+
+// in a group's process, which is a copy of the shell that does not exec: drop
+// what it shares with the shell, so the two do not act on each other's fds
+static void leaveShell(List_t* bgList) {
+    eventForget();      // first, so that the closes below leave the shell's loop alone
+    timerForget();
+    completeClose();
+    forgetList(bgList);
+    jobTableForget();
+    metricsClose();
+}
+
+// start the group at item g in a child; the child carries on inside it
+static void forkGroup(cmd_item_t* g, int index, int* status, List_t* bgList) {
+    uint64_t spawnStart;
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+    spawnStart = metricsNow();
+    if ((pid = fork()) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        leaveShell(bgList);
+        exitAt = g->end;
+        next = index + 1;
+        return;
+    }
+    TRACE(TRACE_SPAWN, pid, 0);
+    metricsSpawned(spawnStart);
+    next = g->end + 1;
+    if (g->bg) {
+        bgentry_t* entry = createBGEntry(createLineJob(g->text), pid, time(NULL));
+        insertInOrder(bgList, entry);
+        jobTableAdd(bgList, entry);
+        METRIC_SET(bgActive, bgList->length);
+        *status = 0;
+        return;
+    }
+    if (waitForeground(pid, status) < 0) {
+        printf(WAIT_ERR);
+        exit(EXIT_FAILURE);
+    }
+    TRACE(TRACE_EXIT, pid, *status);
+}
+
+char* cmdNextLine(const char* prompt, int status, List_t* bgList) {
+    char* line;
+
+    for (;;) {
+        lastStatus = status;
+        if (next >= nitems) {
+            freeItems();
+            if ((line = recordNextLine(prompt, exitCode(status))) == NULL) {
+                return NULL;
+            }
+            histAppend(line);
+            if (parseLine(line) == -1) {
+                status = 2 << 8;
+            }
+            continue;
+        }
+
+        cmd_item_t* item = &items[next];
+        int ok = exitCode(status) == 0;
+        if ((item->link == CMD_AND && !ok) || (item->link == CMD_OR && ok)) {
+            next = item->type == CMD_GROUP ? item->end + 1 : next + 1;
+            continue;
+        }
+        switch (item->type) {
+        case CMD_PIPELINE:
+            next++;
+            return strdup(item->text);
+        case CMD_GROUP:
+            if (item->fork) {
+                forkGroup(item, next, &status, bgList);
+            } else {
+                next++;
+            }
+            break;
+        case CMD_GROUP_END:
+            if (exitAt == next) {
+                exit(exitCode(status));
+            }
+            next++;
+            break;
+        }
+    }
+}
+
+void cmdExitGroup(job_info* job) {
+    if (exitAt != -1) {
+        exit(job->procs->argc > 1 ? atoi(job->procs->argv[1]) & 0xff : exitCode(lastStatus));
+    }
+}
@@ -0,0 +1,315 @@
+#include "complete.h"
+#include "events.h"
+#include "vars.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/readline.h>
+
+#define BUILTIN_BIT (1ULL << 63)
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                    IN_DELETE_SELF | IN_MOVE_SELF)
+#define INOTIFY_BUF 8192
+
+/*
+ * Trie node. Children of a node are a singly linked sibling list; nodes
+ * live in one array and refer to each other by index. dirs has a bit for
+ * every PATH directory that holds an executable with this exact name, so a
+ * name stays completable until the last directory providing it drops it.
+ */
+typedef struct tnode {
+    int child;
+    int sibling;
+    unsigned long long dirs;
+    char c;
+} tnode_t;
+
+static const char* builtins[] = {
+    "affinity", "ascii53", "bgcapture", "bglist", "bgout", "bgpersist", "bgtimeout", "bgtop",
+    "cd", "estatus", "exit", "export", "globcache", "history", "memo", "pipesize", "pipestat",
+    "priority", "sched", "trace", "ulimit", "unset", NULL
+};
+
+static tnode_t* nodes = NULL;
+static int nnodes = 0;
+static int capNodes = 0;
+static char* builtPath = NULL;      // PATH the trie was built from; NULL if not built
+static char* dirPaths[COMPLETE_MAX_DIRS];
+static int dirWd[COMPLETE_MAX_DIRS];
+static int ndirs = 0;
+static int ifd = -1;
+
+// matches of the current completion, handed out one by one (readline frees them)
+static char** matches = NULL;
+static int nmatches = 0;
+static int capMatches = 0;
+
+static int newNode(char c) {
+    if (nnodes == capNodes) {
+        capNodes = capNodes ? capNodes * 2 : 4096;
+        nodes = realloc(nodes, capNodes * sizeof(tnode_t));
+    }
+    nodes[nnodes].child = -1;
+    nodes[nnodes].sibling = -1;
+    nodes[nnodes].dirs = 0;
+    nodes[nnodes].c = c;
+    return nnodes++;
+}
+
+// node for name, created along the way if create is set; -1 if absent
+static int findNode(const char* name, int create) {
+    int n = 0;
+
+    for (; *name; name++) {
+        int k = nodes[n].child;
+        while (k != -1 && nodes[k].c != *name) {
+            k = nodes[k].sibling;
+        }
+        if (k == -1) {
+            if (!create) {
+                return -1;
+            }
+            k = newNode(*name);
+            nodes[k].sibling = nodes[n].child;
+            nodes[n].child = k;
+        }
+        n = k;
+    }
+    return n;
+}
+
+static void trieSet(const char* name, unsigned long long bit, int present) {
+    int n = findNode(name, present);
+    if (n == -1) {
+        return;
+    }
+    if (present) {
+        nodes[n].dirs |= bit;
+    } else {
+        nodes[n].dirs &= ~bit;
+    }
+}
+
+static int isExecutable(int dirfd, const char* name) {
+    struct stat st;
+    return fstatat(dirfd, name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111);
+}
+
+static void scanDir(int d, const char* path) {
+    struct dirent* ent;
+    DIR* dir = opendir(path);
+
+    if (dir == NULL) {
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.' || ent->d_type == DT_DIR) {
+            continue;
+        }
+        if (isExecutable(dirfd(dir), ent->d_name)) {
+            trieSet(ent->d_name, 1ULL << d, 1);
+        }
+    }
+    closedir(dir);
+}
+
+static void dropTrie() {
+    int i;
+
+    if (ifd != -1) {
+        eventRemove(ifd);
+        close(ifd);
+        ifd = -1;
+    }
+    for (i = 0; i < ndirs; i++) {
+        free(dirPaths[i]);
+        dirWd[i] = -1;
+    }
+    ndirs = 0;
+    nnodes = 0;
+    free(builtPath);
+    builtPath = NULL;
+}
+
+static void watchReady(int fd, unsigned int events, void* arg);
+
+static void buildTrie(const char* path) {
+    char dirPath[PATH_MAX];
+    const char* p = path;
+    int i;
+
+    dropTrie();
+    builtPath = strdup(path);
+    newNode('\0');  // root
+    for (i = 0; builtins[i] != NULL; i++) {
+        trieSet(builtins[i], BUILTIN_BIT, 1);
+    }
+
+    ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd != -1 && eventAdd(ifd, EPOLLIN, watchReady, NULL) == -1) {
+        close(ifd);
+        ifd = -1;
+    }
+    while (*p != '\0' && ndirs < COMPLETE_MAX_DIRS) {
+        size_t len = strcspn(p, ":");
+        if (len > 0 && len < sizeof(dirPath)) {
+            memcpy(dirPath, p, len);
+            dirPath[len] = '\0';
+            // watch before scanning so nothing installed in between is missed
+            dirPaths[ndirs] = strdup(dirPath);
+            dirWd[ndirs] = ifd == -1 ? -1 : inotify_add_watch(ifd, dirPath, WATCH_MASK | IN_ONLYDIR);
+            scanDir(ndirs, dirPath);
+            ndirs++;
+        }
+        p += len;
+        if (*p == ':') {
+            p++;
+        }
+    }
+}
+
+// a PATH directory went away or was renamed: forget everything it provided
+static void dropDir(int d) {
+    int i;
+    for (i = 0; i < nnodes; i++) {
+        nodes[i].dirs &= ~(1ULL << d);
+    }
+    dirWd[d] = -1;
+}
+
+static void watchReady(int fd, unsigned int events, void* arg) {
+    char buf[INOTIFY_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    char* p;
+    int d;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // events were lost; start over on the next completion
+                free(builtPath);
+                builtPath = NULL;
+                return;
+            }
+            // PATH entries that are one directory (/bin and /usr/bin with usrmerge) share a wd
+            for (d = 0; d < ndirs; d++) {
+                if (dirWd[d] != ev->wd) {
+                    continue;
+                }
+                if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    dropDir(d);
+                } else if (ev->len > 0 && ev->name[0] != '.') {
+                    int present = 0;
+                    if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) {
+                        char full[PATH_MAX];
+                        snprintf(full, sizeof(full), "%s/%s", dirPaths[d], ev->name);
+                        present = isExecutable(AT_FDCWD, full);
+                    }
+                    trieSet(ev->name, 1ULL << d, present);
+                }
+            }
+        }
+    }
+}
+
+static void addMatch(const char* name) {
+    if (nmatches == capMatches) {
+        capMatches = capMatches ? capMatches * 2 : 64;
+        matches = realloc(matches, capMatches * sizeof(char*));
+    }
+    matches[nmatches++] = strdup(name);
+}
+
+// every name below node n; buf holds the name so far
+static void collect(int n, char* buf, int len) {
+    int k;
+
+    if (nodes[n].dirs != 0) {
+        buf[len] = '\0';
+        addMatch(buf);
+    }
+    if (len + 1 >= PATH_MAX) {
+        return;
+    }
+    for (k = nodes[n].child; k != -1; k = nodes[k].sibling) {
+        buf[len] = nodes[k].c;
+        collect(k, buf, len + 1);
+    }
+}
+
+static char* nextMatch(const char* text, int state) {
+    static int next;
+
+    if (state == 0) {
+        next = 0;
+    }
+    return next < nmatches ? matches[next++] : NULL;
+}
+
+// is start the first word of a command: after |, ;, &, &&, || or ( ?
+static int commandPosition(int start) {
+    int i = start - 1;
+    while (i >= 0 && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t')) {
+        i--;
+    }
+    if (i < 0 || strchr("|;(", rl_line_buffer[i]) != NULL) {
+        return 1;
+    }
+    // & but not the one of a redirection such as 2>&1
+    return rl_line_buffer[i] == '&' && (i == 0 || rl_line_buffer[i - 1] != '>');
+}
+
+static char** completeCommand(const char* text, int start, int end) {
+    char buf[PATH_MAX];
+    const char* path;
+    int n;
+
+    if (!commandPosition(start) || strchr(text, '/') != NULL) {
+        return NULL;
+    }
+    path = varGet("PATH");
+    if (path == NULL) {
+        path = "";
+    }
+    if (builtPath == NULL || strcmp(builtPath, path) != 0) {
+        buildTrie(path);
+    }
+
+    nmatches = 0;
+    if ((n = findNode(text, 0)) == -1) {
+        return NULL;
+    }
+    strncpy(buf, text, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    collect(n, buf, strlen(buf));
+    if (nmatches == 0) {
+        return NULL;
+    }
+    return rl_completion_matches(text, nextMatch);
+}
+
+void completeInit() {
+    int i;
+    for (i = 0; i < COMPLETE_MAX_DIRS; i++) {
+        dirWd[i] = -1;
+    }
+    rl_attempted_completion_function = completeCommand;
+}
+
+void completeClose() {
+    dropTrie();
+    free(nodes);
+    nodes = NULL;
+    capNodes = 0;
+    free(matches);
+    matches = NULL;
+    nmatches = capMatches = 0;
+}
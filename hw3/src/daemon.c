@@ -0,0 +1,428 @@
+#include "daemon.h"
+#include "events.h"
+#include "helpers.h"
+#include "pathglob.h"
+#include "timers.h"
+#include "trace.h"
+#include "vars.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+typedef struct client {
+    int sock;           // -1 once the client has gone away
+    int fds[3];         // the client's stdin, stdout and stderr
+    int cwd;            // the client's working directory
+    unsigned int seq;   // lines received so far
+    int watched;        // processes not yet reaped
+    List_t* jobs;       // this client's job table
+    struct client* next;
+} client_t;
+
+// one process being waited for; its pidfd is on the event loop
+typedef struct watch {
+    client_t* client;
+    pid_t pid;
+    int pidfd;
+    unsigned int seq;   // line that started the job
+} watch_t;
+
+static client_t* clients = NULL;
+static int serverFds[3];    // the daemon's own stdio while a client's is in place
+static int serverCwd;       // and its own directory, the default for new clients
+static volatile sig_atomic_t stopFlag = 0;
+
+static void stopHandler(int sig) {
+    stopFlag = 1;
+}
+
+static void reply(client_t* c, const char* fmt, ...) {
+    char buf[64];
+    va_list ap;
+    int n;
+
+    if (c->sock == -1) {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    send(c->sock, buf, n, MSG_NOSIGNAL);
+}
+
+// put the client's stdio and directory in place of the daemon's
+static void enterClient(client_t* c) {
+    int i;
+    for (i = 0; i < 3; i++) {
+        dup2(c->fds[i], i);
+    }
+    if (fchdir(c->cwd) == -1) {
+        // the directory is gone; run from wherever the daemon is
+    }
+}
+
+static void leaveClient() {
+    int i;
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < 3; i++) {
+        dup2(serverFds[i], i);
+    }
+    if (fchdir(serverCwd) == -1) {
+        // nothing better to go back to
+    }
+}
+
+static void freeClient(client_t* c) {
+    client_t** link = &clients;
+    int i;
+
+    while (*link != c) {
+        link = &(*link)->next;
+    }
+    *link = c->next;
+    for (i = 0; i < 3; i++) {
+        if (c->fds[i] != -1) {
+            close(c->fds[i]);
+        }
+    }
+    close(c->cwd);
+    free(c->jobs);
+    free(c);
+}
+
+// the client is gone: kill its jobs, free it once they are all reaped
+static void dropClient(client_t* c) {
+    node_t* node;
+    int i;
+
+    eventRemove(c->sock);
+    close(c->sock);
+    c->sock = -1;
+    for (node = c->jobs->head; node != NULL; node = node->next) {
+        bgentry_t* entry = (bgentry_t*)node->value;
+        kill(entry->pid, SIGKILL);
+        for (i = 1; entry->pids != NULL && i < entry->nstages; i++) {
+            if (entry->pids[i] > 0) {
+                kill(entry->pids[i], SIGKILL);
+            }
+        }
+    }
+    if (c->watched == 0) {
+        freeClient(c);
+    }
+}
+
+static void jobExited(int fd, unsigned int events, void* arg) {
+    watch_t* w = (watch_t*)arg;
+    client_t* c = w->client;
+    int status = 0;
+    int limit;
+
+    if (waitpid(w->pid, &status, WNOHANG) == 0) {
+        return;
+    }
+    TRACE(TRACE_EXIT, w->pid, status);
+    if ((limit = timerCancel(w->pid)) > 0) {
+        dprintf(c->fds[1], TIMEOUT_MSG, w->pid, limit);
+        status = TIMEOUT_STATUS << 8;
+    }
+
+    // a job is done once its last running stage is reaped
+    bgentry_t* entry = findByPID(c->jobs, w->pid);
+    if (entry != NULL) {
+        if (entry->pids == NULL || entry->pids[entry->nstages - 1] == w->pid) {
+            entry->status = status;
+        }
+        if (stageReaped(entry, w->pid) == 0) {
+            unlinkByPID(c->jobs, entry->pid);
+            if (entry->job->bg && c->sock != -1) {
+                dprintf(c->fds[1], BG_TERM, entry->pid, entry->job->line);
+            }
+            TRACE(TRACE_BG_TERM, entry->pid, 0);
+            reply(c, "%u exit %d %d\n", w->seq, entry->pid, exitCode(entry->status));
+            freeBGEntry(entry);
+        }
+    }
+
+    eventRemove(w->pidfd);
+    close(w->pidfd);
+    free(w);
+    if (--c->watched == 0 && c->sock == -1) {
+        freeClient(c);
+    }
+}
+
+static void watchProcess(client_t* c, pid_t pid) {
+    watch_t* w = malloc(sizeof(watch_t));
+
+    w->client = c;
+    w->pid = pid;
+    w->seq = c->seq;
+    w->pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (w->pidfd < 0 || eventAdd(w->pidfd, EPOLLIN, jobExited, w) == -1) {
+        // cannot watch it without blocking every other client
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        if (w->pidfd >= 0) {
+            close(w->pidfd);
+        }
+        free(w);
+        return;
+    }
+    c->watched++;
+}
+
+// parse and start one line in the client's context; returns -1 to disconnect
+static int runLine(client_t* c, char* line) {
+    job_opts_t opts;
+    pid_t pid;
+    int status;
+    int i;
+
+    globReset();
+    job_info* job = validate_input(line);
+    if (job == NULL) {
+        status = strspn(line, " \t\n") == strlen(line) ? 0 : 2;
+        reply(c, "%u exit 0 %d\n", c->seq, status);
+        free(line);
+        return 0;
+    }
+    if (stripJobOpts(job, &opts) == -1) {
+        reply(c, "%u exit 0 2\n", c->seq);
+        freeAndNull(job, line);
+        return 0;
+    }
+    // a memo run is waited for in the server, which would stall every client
+    if (opts.memo) {
+        fprintf(stderr, OPT_ERR, "memo");
+        reply(c, "%u exit 0 2\n", c->seq);
+        freeAndNull(job, line);
+        return 0;
+    }
+    expandVars(job);
+    expandJob(job);
+
+    if (strcmp(job->procs->cmd, "exit") == 0) {
+        reply(c, "%u exit 0 0\n", c->seq);
+        freeAndNull(job, line);
+        return -1;
+    }
+
+    // each client keeps its own working directory
+    if (strcmp(job->procs->cmd, "cd") == 0) {
+        int failed = changeDir(job) == -1;
+        int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (cwd != -1) {
+            close(c->cwd);
+            c->cwd = cwd;
+        }
+        reply(c, "%u exit 0 %d\n", c->seq, failed ? EXIT_FAILURE : 0);
+        freeAndNull(job, line);
+        return 0;
+    }
+
+    if (strcmp(job->procs->cmd, "bglist") == 0) {
+        printList(c->jobs, STR_MODE);
+        reply(c, "%u exit 0 0\n", c->seq);
+        freeAndNull(job, line);
+        return 0;
+    }
+
+    // every job runs like a background job here; nothing may block the loop
+    if (job->nproc > 1) {
+        bool bg = job->bg;
+        job->bg = true;
+        status = piping(job, line, c->jobs, &opts);
+        job->bg = bg;
+        if (status == -1) {
+            reply(c, "%u exit 0 2\n", c->seq);
+            freeAndNull(job, line);
+            return 0;
+        }
+        free(line);
+        bgentry_t* entry = NULL;
+        node_t* node;
+        for (node = c->jobs->head; node != NULL; node = node->next) {
+            if (((bgentry_t*)node->value)->job == job) {
+                entry = (bgentry_t*)node->value;
+            }
+        }
+        pid = entry->pid;
+        for (i = 0; i < entry->nstages; i++) {
+            watchProcess(c, entry->pids[i]);
+        }
+    } else {
+        char** envp = varsEnviron();
+        if ((pid = fork()) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            execJob(job, line, &opts, NULL, envp);
+        }
+        TRACE(TRACE_SPAWN, pid, 0);
+        if (opts.timeout > 0) {
+            timerArm(pid, timerDeadline(opts.timeout), opts.timeout);
+        }
+        bgentry_t* entry = createBGEntry(job, pid, time(NULL));
+        if (hasJobOpts(&opts)) {
+            entry->opts = malloc(sizeof(job_opts_t));
+            memcpy(entry->opts, &opts, sizeof(job_opts_t));
+        }
+        insertInOrder(c->jobs, entry);
+        free(line);
+        watchProcess(c, pid);
+    }
+    if (job->bg) {
+        reply(c, "%u bg %d\n", c->seq, pid);
+    }
+    return 0;
+}
+
+static void clientReady(int fd, unsigned int events, void* arg) {
+    client_t* c = (client_t*)arg;
+    char buf[DAEMON_LINE_MAX];
+    char ctl[CMSG_SPACE(4 * sizeof(int))];
+    struct iovec iov = {buf, sizeof(buf) - 1};
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    ssize_t n;
+    int i;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+    n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+            dropClient(c);
+        }
+        return;
+    }
+
+    // new stdio for this client's jobs
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* fds = (int*)CMSG_DATA(cmsg);
+        for (i = 0; i < nfds; i++) {
+            if (nfds < 3 || i > 3) {
+                close(fds[i]);
+            } else if (i == 3) {
+                close(c->cwd);
+                c->cwd = fds[i];
+            } else {
+                if (c->fds[i] != -1) {
+                    close(c->fds[i]);
+                }
+                c->fds[i] = fds[i];
+            }
+        }
+    }
+
+    c->seq++;
+    if (c->fds[0] == -1 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        reply(c, "%u exit 0 2\n", c->seq);
+        return;
+    }
+    buf[n] = '\0';
+    enterClient(c);
+    int done = runLine(c, strdup(buf));
+    leaveClient();
+    if (done == -1) {
+        dropClient(c);
+    }
+}
+
+static void acceptClient(int fd, unsigned int events, void* arg) {
+    int sock = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (sock == -1) {
+        return;
+    }
+    client_t* c = calloc(1, sizeof(client_t));
+    c->sock = sock;
+    c->fds[0] = c->fds[1] = c->fds[2] = -1;
+    c->cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    c->jobs = createList(&bgentryComparator);
+    c->next = clients;
+    clients = c;
+    if (eventAdd(sock, EPOLLIN, clientReady, c) == -1) {
+        close(sock);
+        c->sock = -1;
+        freeClient(c);
+    }
+}
+
+// clear the way for bind: only a socket left by a server that is gone may be removed
+static int claimPath(const struct sockaddr_un* addr) {
+    struct stat st;
+    int fd, refused;
+
+    if (lstat(addr->sun_path, &st) == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (!S_ISSOCK(st.st_mode) || (fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) {
+        return -1;
+    }
+    refused = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == -1 && errno == ECONNREFUSED;
+    close(fd);
+    return refused ? unlink(addr->sun_path) : -1;
+}
+
+int daemonServe(const char* path) {
+    struct sockaddr_un addr;
+    int lfd;
+    int i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, DAEMON_ERR, path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+
+    lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (lfd == -1 || claimPath(&addr) == -1 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(lfd, DAEMON_BACKLOG) == -1 || eventAdd(lfd, EPOLLIN, acceptClient, NULL) == -1) {
+        fprintf(stderr, DAEMON_ERR, path);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < 3; i++) {
+        serverFds[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+    }
+    serverCwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopHandler);
+    signal(SIGTERM, stopHandler);
+    while (!stopFlag) {
+        if (eventPoll(-1) < 0) {
+            break;
+        }
+    }
+
+    // like exit in the shell, stopping takes every client's jobs down
+    client_t* c = clients;
+    while (c != NULL) {
+        client_t* next = c->next;
+        if (c->sock != -1) {
+            dropClient(c);
+        }
+        c = next;
+    }
+    unlink(path);
+    close(lfd);
+    validate_input(NULL);
+    return 0;
+}
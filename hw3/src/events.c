@@ -0,0 +1,157 @@
+#include "events.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <readline/readline.h>
+
+#define MAX_EVENTS 64
+#define WAIT_POLL_MS 10     // how often to check on a foreground child without a pidfd
+
+typedef struct handler {
+    event_cb cb;
+    void* arg;
+} handler_t;
+
+static int epfd = -1;
+static handler_t* handlers = NULL;  // indexed by fd
+static int nhandlers = 0;
+
+static int eventInit() {
+    if (epfd == -1) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    return epfd;
+}
+
+int eventAdd(int fd, unsigned int events, event_cb cb, void* arg) {
+    struct epoll_event ev;
+
+    if (fd < 0 || eventInit() < 0) {
+        return -1;
+    }
+    if (fd >= nhandlers) {
+        int size = nhandlers ? nhandlers : 16;
+        while (size <= fd) {
+            size *= 2;
+        }
+        handler_t* grown = realloc(handlers, size * sizeof(handler_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        memset(grown + nhandlers, 0, (size - nhandlers) * sizeof(handler_t));
+        handlers = grown;
+        nhandlers = size;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        return -1;
+    }
+    handlers[fd].cb = cb;
+    handlers[fd].arg = arg;
+    return 0;
+}
+
+void eventRemove(int fd) {
+    if (epfd == -1 || fd < 0 || fd >= nhandlers || handlers[fd].cb == NULL) {
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    handlers[fd].cb = NULL;
+    handlers[fd].arg = NULL;
+}
+
+void eventForget() {
+    if (epfd != -1) {
+        close(epfd);
+        epfd = -1;
+    }
+    free(handlers);
+    handlers = NULL;
+    nhandlers = 0;
+}
+
+int eventPoll(int timeout) {
+    struct epoll_event evs[MAX_EVENTS];
+    int n, i, ran = 0;
+
+    if (eventInit() < 0) {
+        return -1;
+    }
+    n = epoll_wait(epfd, evs, MAX_EVENTS, timeout);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (i = 0; i < n; i++) {
+        int fd = evs[i].data.fd;
+        // an earlier callback in this batch may have removed fd
+        if (fd < nhandlers && handlers[fd].cb != NULL) {
+            handlers[fd].cb(fd, evs[i].events, handlers[fd].arg);
+            ran++;
+        }
+    }
+    return ran;
+}
+
+int eventPollWith(int fd, int timeout) {
+    struct pollfd fds[2];
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = eventInit();
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, timeout) <= 0) {
+        return 0;
+    }
+    if (fds[1].revents & POLLIN) {
+        eventPoll(0);
+    }
+    return (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+int eventGetc(FILE* stream) {
+    int fd = fileno(stream);
+
+    while (!eventPollWith(fd, -1))
+        ;
+    return rl_getc(stream);
+}
+
+static void pidfdReady(int fd, unsigned int events, void* arg) {
+    *(int*)arg = 1;
+}
+
+pid_t waitForeground(pid_t pid, int* status) {
+    int done = 0;
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+
+    // no pidfd support: check on the child between short polls, since it may
+    // be waiting on something only the loop services (pipestat's relays)
+    if (pidfd < 0 || eventAdd(pidfd, EPOLLIN, pidfdReady, &done) == -1) {
+        pid_t reaped;
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+        while ((reaped = waitpid(pid, status, WNOHANG)) == 0) {
+            if (eventPoll(WAIT_POLL_MS) < 0) {
+                return waitpid(pid, status, 0);     // no loop to service
+            }
+        }
+        return reaped;
+    }
+    while (!done) {
+        if (eventPoll(-1) < 0) {
+            break;
+        }
+    }
+    eventRemove(pidfd);
+    close(pidfd);
+    return waitpid(pid, status, 0);
+}
@@ -1,6 +1,17 @@
 #include "helpers.h"
 #include "linkedList.h"
 #include "icssh.h"
+#include "capture.h"
+#include "events.h"
+#include "jobtable.h"
+#include "metrics.h"
+#include "timers.h"
+#include "trace.h"
+#include "pathglob.h"
+#include "vars.h"
+#include "pipestat.h"
+#include "memo.h"
+#include <errno.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -87,9 +98,9 @@ void freeAndNull(job_info* job, char * line) {
 	line = NULL;
 }
 
-void changeDir(job_info *job) {
+int changeDir(job_info *job) {
     			if (job->procs->argc == 1) {
-				char* home = getenv("HOME");
+				char* home = varGet("HOME");
 				int pathCheck = chdir(home);
 				if (pathCheck == 0) {
 					char* cPath = getcwd(NULL, 0);
@@ -98,6 +109,7 @@ void changeDir(job_info *job) {
 					cPath = NULL;
 				} else {
 					fprintf(stderr, DIR_ERR);
+					return -1;
 				}
 
 			} else {
@@ -109,8 +121,10 @@ void changeDir(job_info *job) {
 					cPath = NULL;
 				} else {
 					fprintf(stderr, DIR_ERR);
+					return -1;
 				}
 			}
+			return 0;
 }
 
 int redirectionCheck(job_info*job) {
@@ -139,6 +153,7 @@ int openIn(job_info* job, char* line) {
     int inSaved = 0;
     in = open(job->in_file, O_RDONLY, 0777);
     if (in == -1) {
+        TRACE(TRACE_RD_ERR, getpid(), errno);
         close(in);
         fprintf(stderr, RD_ERR);
         freeAndNull(job, line);
@@ -174,14 +189,31 @@ int openErr(job_info* job, char* line) {
     return errSaved;
 }
 
-void piping(job_info* job, char* line, List_t* bgList) {
+int piping(job_info* job, char* line, List_t* bgList, job_opts_t* opts) {
     int fd[2];
     pid_t pid;
+    uint64_t spawnStart;
     int exec_result;
-    int exit_status;
+    int exit_status = 0;
     pid_t wait_result;
     
     proc_info* proc = job->procs;
+    int stage = 0;
+
+    // every stage starts from the job's options plus its own prefixes
+    job_opts_t* stageOpts = malloc(job->nproc * sizeof(job_opts_t));
+    for (stage = 0; proc != NULL; stage++, proc = proc->next_proc) {
+        memcpy(&stageOpts[stage], opts, sizeof(job_opts_t));
+        if (stage > 0 && stripStageOpts(proc, &stageOpts[stage]) == -1) {
+            free(stageOpts);
+            return -1;
+        }
+    }
+    proc = job->procs;
+    stage = 0;
+
+    // built (when a variable changed) here, where the cache outlives the fork
+    char** envp = varsEnviron();
 
     sigset_t mask_all, mask_child, prev_mask;
 	sigfillset(&mask_all);
@@ -189,16 +221,29 @@ void piping(job_info* job, char* line, List_t* bgList) {
 	sigaddset(&mask_child, SIGCHLD);
 
     int pipeReadEnd = STDIN_FILENO;
-    int firstPipe = 1;
+    pid_t* pids = malloc(job->nproc * sizeof(pid_t));
+    capture_t* cap = job->bg ? captureOpen(job) : NULL;
+    pipestat_t* stats = opts->pipeStat ? pipestatOpen(job) : NULL;
+    // one deadline for the whole pipeline, shared by every stage
+    unsigned long long deadline = timerDeadline(opts->timeout);
+
+    // block sigchild until every stage is accounted for
+    sigprocmask(SIG_BLOCK, &mask_child, &prev_mask);
 
+    // start every stage before waiting on any, so that they run concurrently
     while (proc != NULL) {
-        if (pipe(fd) == -1) {
+        // measured links are relayed by the shell instead of one plain pipe
+        if (stats != NULL && proc->next_proc != NULL) {
+            if (pipestatLink(stats, stage, fd, opts->pipeSize) == -1) {
+                exit(EXIT_FAILURE);
+            }
+        } else if (pipe(fd) == -1) {
             exit(EXIT_FAILURE);
+        } else {
+            pipeResize(fd[1], opts->pipeSize);
         }
 
-        // block sigchild
-		sigprocmask(SIG_BLOCK, &mask_child, &prev_mask);
-
+        spawnStart = metricsNow();
         if ((pid = fork()) < 0) {
             exit(EXIT_FAILURE);
         }
@@ -210,7 +255,15 @@ void piping(job_info* job, char* line, List_t* bgList) {
             // pipeReadEnd initially set to STDIN_FILENO before start of while loop
             // this dup2 allows the output of the previous pipe to be connected to
             // the current pipe
-            dup2(pipeReadEnd, STDIN_FILENO);
+            if (pipeReadEnd != STDIN_FILENO) {
+                dup2(pipeReadEnd, STDIN_FILENO);
+                close(pipeReadEnd);
+            }
+
+            // stderr of every stage and stdout of the last go to the capture
+            if (cap != NULL) {
+                captureChild(cap, proc->next_proc == NULL);
+            }
 
             // if there is another process then then we need to continue writing
             // to the pipe, otherwise we can just print the final output
@@ -219,9 +272,20 @@ void piping(job_info* job, char* line, List_t* bgList) {
             }
 
             close(fd[0]);
+            close(fd[1]);
+
+            if (applyJobOpts(&stageOpts[stage]) == -1) {
+                freeAndNull(job, line);
+                validate_input(NULL);
+                exit(EXIT_FAILURE);
+            }
+            TRACE(TRACE_EXEC, getpid(), stage);
+            environ = envp;
             int exec_result = execvp(proc->cmd, proc->argv);
 
             if (exec_result < 0) {  //Error checking
+                TRACE(TRACE_EXEC_ERR, getpid(), errno);
+                metricsExecFailed();
                 printf(EXEC_ERR, proc->cmd);
                 freeAndNull(job, line);
                 validate_input(NULL);
@@ -230,31 +294,259 @@ void piping(job_info* job, char* line, List_t* bgList) {
             
 
         } else {
-            if (firstPipe && job->bg) { // if job is a background process
-                sigprocmask(SIG_BLOCK, &mask_all, NULL); // block all
-                time_t receivedTime;
-                bgentry_t* bgEnt = createBGEntry(job, pid, time(&receivedTime));
-                insertInOrder(bgList, bgEnt);
-				sigprocmask(SIG_SETMASK, &prev_mask, NULL); // set mask to prev (before block all)
-                firstPipe = 0;
-
-            } else {
-
-                wait_result = waitpid(pid, &exit_status, 0);
-                if (wait_result < 0) {
-                    printf(WAIT_ERR);
-                    exit(EXIT_FAILURE);
+            pids[stage] = pid;
+            TRACE(TRACE_SPAWN, pid, stage);
+            metricsSpawned(spawnStart);
+            if (stageOpts[stage].timeout > 0) {
+                if (stageOpts[stage].timeout != opts->timeout) {
+                    timerArm(pid, timerDeadline(stageOpts[stage].timeout), stageOpts[stage].timeout);
+                } else {
+                    timerArm(pid, deadline, opts->timeout);
                 }
             }
-            // set mask to before blocking child
-            sigprocmask(SIG_SETMASK, &prev_mask, NULL);
 
             // fd of read end of pipe is saved so that the next child in the loop
-            // can use this for stdin
+            // can use this for stdin; the previous one is no longer needed here
+            if (pipeReadEnd != STDIN_FILENO) {
+                close(pipeReadEnd);
+            }
             pipeReadEnd = fd[0];
             close(fd[1]);
             proc = proc->next_proc;
+            stage++;
+        }
+
+    }
+    close(pipeReadEnd);
+    if (cap != NULL) {
+        captureCloseWriters(cap);
+    }
+
+    if (job->bg) { // if job is a background process
+        sigprocmask(SIG_BLOCK, &mask_all, NULL); // block all
+        time_t receivedTime;
+        bgentry_t* bgEnt = createBGEntry(job, pids[0], time(&receivedTime));
+        bgEnt->pids = pids;
+        bgEnt->nstages = job->nproc;
+        bgEnt->running = job->nproc;
+        if (cap != NULL) {
+            cap->pid = pids[0];
+            bgEnt->capture = cap;
         }
+        if (hasJobOpts(opts)) {
+            bgEnt->opts = malloc(sizeof(job_opts_t));
+            memcpy(bgEnt->opts, opts, sizeof(job_opts_t));
+        }
+        bgEnt->stats = stats;
+        insertInOrder(bgList, bgEnt);
+        jobTableAdd(bgList, bgEnt);
+        METRIC_SET(bgActive, bgList->length);
+        pids = NULL;
+    } else {
+        for (stage = 0; stage < job->nproc; stage++) {
+            wait_result = waitForeground(pids[stage], &exit_status);
+            if (wait_result < 0) {
+                printf(WAIT_ERR);
+                exit(EXIT_FAILURE);
+            }
+            TRACE(TRACE_EXIT, pids[stage], exit_status);
+            if (timerCancel(pids[stage]) > 0) {
+                printf(TIMEOUT_MSG, pids[stage], stageOpts[stage].timeout);
+                exit_status = TIMEOUT_STATUS << 8;
+            }
+        }
+        if (stats != NULL) {
+            pipestatFinish(stats);
+            pipestatReport(stats, stdout);
+            pipestatFree(stats);
+        }
+    }
+    // set mask to before blocking child
+    sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+
+    free(pids);
+    free(stageOpts);
+    return exit_status;
+}
+
+void execJob(job_info* job, char* line, job_opts_t* opts, capture_t* cap, char** envp) {
+    if (cap != NULL) {
+        captureChild(cap, 1);
+    }
+
+    // affinity, priority, scheduling policy and limits from the prefixes
+    if (applyJobOpts(opts) == -1) {
+        freeAndNull(job, line);
+        validate_input(NULL);
+        exit(EXIT_FAILURE);
+    }
+
+    // error checking for file redirection
+    if (redirectionCheck(job) == -1) {
+        TRACE(TRACE_RD_ERR, getpid(), 0);
+        fprintf(stderr, RD_ERR);
+        freeAndNull(job, line);
+        exit(EXIT_FAILURE);
+    }
+
+    // perform file redirection
+    if (job->in_file != NULL) {
+        if (openIn(job, line) == -1) {
+            validate_input(NULL);
+            exit(EXIT_FAILURE);
+        }
+    }
 
+    if (job->out_file != NULL) {
+        openOut(job, line);
+    }
+
+    if (job->procs->err_file != NULL) {
+        openErr(job, line);
+    }
+
+    // get the first command in the job list
+    proc_info* proc = job->procs;
+    TRACE(TRACE_EXEC, getpid(), 0);
+    environ = envp;     // execvp searches the PATH in it
+    execvp(proc->cmd, proc->argv);
+
+    TRACE(TRACE_EXEC_ERR, getpid(), errno);
+    metricsExecFailed();
+    printf(EXEC_ERR, proc->cmd);
+
+    // Cleaning up to make Valgrind happy
+    // (not necessary because child will exit. Resources will be reaped by parent)
+    freeAndNull(job, line);
+    validate_input(NULL);  // calling validate_input with NULL will free the memory it has allocated
+    exit(EXIT_FAILURE);
+}
+
+int exitCode(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// the builtins of -c mode; -1 if job is not one of them
+static int oneShotBuiltin(job_info* job) {
+    proc_info* proc = job->procs;
+
+    if (job->nproc > 1 || job->bg) {
+        return -1;
+    }
+    if (strcmp(proc->cmd, "cd") == 0) {
+        return changeDir(job) == -1 ? EXIT_FAILURE : 0;
+    }
+    if (strcmp(proc->cmd, "exit") == 0) {
+        return proc->argc > 1 ? atoi(proc->argv[1]) & 0xff : 0;
+    }
+    if (strcmp(proc->cmd, "export") == 0) {
+        exportCommand(proc);
+        return 0;
+    }
+    if (strcmp(proc->cmd, "unset") == 0) {
+        unsetCommand(proc);
+        return 0;
+    }
+    return -1;
+}
+
+int runCommandString(char* cmdLine) {
+    job_opts_t opts;
+    int status = 0;
+    pid_t pid;
+    char* line = strdup(cmdLine);
+    job_info* job = validate_input(line);
+
+    if (job == NULL) {  // empty line succeeds, a parse error does not
+        status = strspn(line, " \t\n") == strlen(line) ? 0 : 2;
+        free(line);
+        return status;
+    }
+    if (stripJobOpts(job, &opts) == -1) {
+        freeAndNull(job, line);
+        return 2;
+    }
+    expandVars(job);
+    expandJob(job);
+
+    if ((status = oneShotBuiltin(job)) != -1) {
+        freeAndNull(job, line);
+        return status;
+    }
+    status = 0;
+
+    // the last (and only) command replaces the shell: no fork, no wait
+    if (job->nproc == 1 && !job->bg && opts.timeout == 0 && !opts.memo) {
+        execJob(job, line, &opts, NULL, varsEnviron());
+    }
+    if (opts.memo) {
+        return exitCode(memoRun(job, line, &opts));
+    }
+
+    if (job->nproc > 1) {
+        List_t* bgList = createList(&bgentryComparator);
+        status = piping(job, line, bgList, &opts);
+        return status < 0 ? 2 : exitCode(status);
+    }
+
+    char** envp = varsEnviron();
+    if ((pid = fork()) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        execJob(job, line, &opts, NULL, envp);
+    }
+    TRACE(TRACE_SPAWN, pid, 0);
+    if (opts.timeout > 0) {
+        timerArm(pid, timerDeadline(opts.timeout), opts.timeout);
+    }
+    if (job->bg) {
+        return 0;
+    }
+    if (waitForeground(pid, &status) < 0) {
+        printf(WAIT_ERR);
+        exit(EXIT_FAILURE);
+    }
+    if (timerCancel(pid) > 0) {
+        printf(TIMEOUT_MSG, pid, opts.timeout);
+        return TIMEOUT_STATUS;
+    }
+    return exitCode(status);
+}
+
+void traceCommand(job_info* job) {
+    proc_info* proc = job->procs;
+    int binary = 0;
+    int arg = 2;
+    int fd = STDOUT_FILENO;
+
+    if (proc->argc < 2) {
+        printf("trace %s\n", traceRing != NULL ? "on" : "off");
+    } else if (strcmp(proc->argv[1], "on") == 0) {
+        if (traceStart() == -1) {
+            fprintf(stderr, TRACE_ERR, "memory");
+        }
+    } else if (strcmp(proc->argv[1], "off") == 0) {
+        traceStop();
+    } else if (strcmp(proc->argv[1], "flush") == 0) {
+        if (arg < proc->argc && strcmp(proc->argv[arg], "-b") == 0) {
+            binary = 1;
+            arg++;
+        }
+        if (arg < proc->argc) {
+            fd = open(proc->argv[arg], O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        } else if (binary) {
+            fd = -1;    // binary output needs a file
+        }
+        fflush(stdout);
+        if (fd == -1 || traceFlush(fd, binary) == -1) {
+            fprintf(stderr, TRACE_ERR, arg < proc->argc ? proc->argv[arg] : "stdout");
+        }
+        if (fd > STDERR_FILENO) {
+            close(fd);
+        }
     }
 }
\ No newline at end of file
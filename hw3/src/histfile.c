@@ -0,0 +1,695 @@
+#include "histfile.h"
+#include "icssh.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#define HIST_SHOW 20    // entries printed by history and history -s by default
+
+static char* logPath = NULL;
+static char* idxPath = NULL;
+static char* lockPath = NULL;
+static int logFd = -1;
+static int lockFd = -1;
+static ino_t logIno = 0;
+
+static char* logMap = NULL;     // the log as of the last refresh
+static size_t logLen = 0;
+static char* idxMap = NULL;
+static size_t idxLen = 0;
+static hist_index_t* idx = NULL;    // NULL unless the index matches the log
+static uint64_t* entryOff;
+static hist_bucket_t* buckets;
+static uint32_t* postings;
+
+static char* lastLine = NULL;   // for skipping repeats
+
+// ^R state: the query and where the last match was
+static char* searchQuery = NULL;
+static char* searchShown = NULL;
+static size_t searchBefore = 0;
+
+static char* pathFor(const char* home, const char* suffix) {
+    size_t len = strlen(home) + strlen(HIST_FILE) + strlen(suffix) + 2;
+    char* path = malloc(len);
+    snprintf(path, len, "%s/%s%s", home, HIST_FILE, suffix);
+    return path;
+}
+
+static void unmapIndex() {
+    if (idxMap != NULL) {
+        munmap(idxMap, idxLen);
+    }
+    idxMap = NULL;
+    idxLen = 0;
+    idx = NULL;
+}
+
+static void mapIndex() {
+    struct stat st;
+    int fd;
+
+    unmapIndex();
+    if ((fd = open(idxPath, O_RDONLY | O_CLOEXEC)) == -1) {
+        return;
+    }
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(hist_index_t)) {
+        idxMap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (idxMap == MAP_FAILED) {
+            idxMap = NULL;
+        } else {
+            idxLen = st.st_size;
+        }
+    }
+    close(fd);
+    if (idxMap == NULL) {
+        return;
+    }
+
+    hist_index_t* h = (hist_index_t*)idxMap;
+    size_t need = sizeof(hist_index_t) + h->nentries * sizeof(uint64_t) +
+                  h->nbuckets * sizeof(hist_bucket_t) + h->npostings * sizeof(uint32_t);
+    if (memcmp(h->magic, HIST_MAGIC, sizeof(HIST_MAGIC)) != 0 || h->logIno != logIno ||
+        need != idxLen || h->indexedLen > logLen) {
+        unmapIndex();
+        return;
+    }
+    idx = h;
+    entryOff = (uint64_t*)(idxMap + sizeof(hist_index_t));
+    buckets = (hist_bucket_t*)(entryOff + h->nentries);
+    postings = (uint32_t*)(buckets + h->nbuckets);
+}
+
+static void mapLog(size_t len) {
+    if (logMap != NULL) {
+        munmap(logMap, logLen);
+    }
+    logMap = NULL;
+    logLen = 0;
+    if (len > 0) {
+        logMap = mmap(NULL, len, PROT_READ, MAP_SHARED, logFd, 0);
+        if (logMap == MAP_FAILED) {
+            logMap = NULL;
+        } else {
+            logLen = len;
+        }
+    }
+}
+
+// follow appends and compactions by other shells
+static void refresh() {
+    struct stat st;
+
+    if (logPath == NULL || stat(logPath, &st) == -1) {
+        return;
+    }
+    if (st.st_ino != logIno) {
+        int fd = open(logPath, O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        close(logFd);
+        logFd = fd;
+        logIno = st.st_ino;
+        mapLog(st.st_size);
+        mapIndex();
+    } else if ((size_t)st.st_size != logLen) {
+        mapLog(st.st_size);
+        if (idx != NULL && idx->indexedLen > logLen) {
+            unmapIndex();
+        }
+    }
+}
+
+static void lock(int how) {
+    if (lockFd != -1) {
+        while (flock(lockFd, how) == -1 && errno == EINTR)
+            ;
+    }
+}
+
+// start and length (without the newline) of the entry at off
+static size_t entryLen(size_t off) {
+    char* nl = memchr(logMap + off, '\n', logLen - off);
+    return nl != NULL ? (size_t)(nl - (logMap + off)) : logLen - off;
+}
+
+// newest line starting in [lo, hi) that contains q, by scanning back from hi
+static long long scanBack(const char* q, size_t qlen, size_t lo, size_t hi) {
+    while (hi > lo) {
+        size_t end = hi - (logMap[hi - 1] == '\n');
+        char* nl = end > lo ? memrchr(logMap + lo, '\n', end - lo) : NULL;
+        size_t start = nl != NULL ? (size_t)(nl + 1 - logMap) : lo;
+        if (memmem(logMap + start, end - start, q, qlen) != NULL) {
+            return start;
+        }
+        hi = start;
+    }
+    return -1;
+}
+
+static uint32_t trigramKey(const char* s) {
+    return (((uint32_t)(unsigned char)s[0] << 16) | ((unsigned char)s[1] << 8) |
+            (unsigned char)s[2]) + 1;
+}
+
+static hist_bucket_t* lookupTrigram(uint32_t key) {
+    uint64_t mask = idx->nbuckets - 1;
+    uint64_t i = (key * 2654435761u) & mask;
+
+    while (buckets[i].key != 0) {
+        if (buckets[i].key == key) {
+            return &buckets[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+static int hasPosting(hist_bucket_t* b, uint32_t id) {
+    uint32_t* list = postings + b->off;
+    size_t lo = 0, hi = b->count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (list[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < b->count && list[lo] == id;
+}
+
+// newest indexed entry before offset before that contains q (at least 3 bytes)
+static long long indexFind(const char* q, size_t qlen, size_t before) {
+    hist_bucket_t* rarest = NULL;
+    size_t i, lo, hi;
+
+    for (i = 0; i + 3 <= qlen; i++) {
+        hist_bucket_t* b = lookupTrigram(trigramKey(q + i));
+        if (b == NULL) {
+            return -1;
+        }
+        if (rarest == NULL || b->count < rarest->count) {
+            rarest = b;
+        }
+    }
+
+    // the last posting of the rarest trigram that starts before before
+    uint32_t* list = postings + rarest->off;
+    lo = 0;
+    hi = rarest->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (entryOff[list[mid]] < before) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo-- > 0) {
+        uint32_t id = list[lo];
+        size_t off = entryOff[id];
+        size_t end = id + 1 < idx->nentries ? entryOff[id + 1] - 1 : idx->indexedLen - 1;
+        int all = 1;
+        for (i = 0; all && i + 3 <= qlen; i++) {
+            hist_bucket_t* b = lookupTrigram(trigramKey(q + i));
+            all = b == rarest || hasPosting(b, id);
+        }
+        if (all && memmem(logMap + off, end - off, q, qlen) != NULL) {
+            return off;
+        }
+    }
+    return -1;
+}
+
+long long histFind(const char* query, size_t before) {
+    size_t qlen = strlen(query);
+    size_t indexed;
+    long long found;
+
+    if (logMap == NULL) {
+        return -1;
+    }
+    if (before > logLen) {
+        before = logLen;
+    }
+    indexed = idx != NULL ? idx->indexedLen : 0;
+
+    // entries appended since the last compaction are newer than any indexed one
+    if (before > indexed) {
+        if ((found = scanBack(query, qlen, indexed, before)) != -1) {
+            return found;
+        }
+        before = indexed;
+    }
+    if (before == 0) {
+        return -1;
+    }
+    return qlen < 3 ? scanBack(query, qlen, 0, before) : indexFind(query, qlen, before);
+}
+
+// ^R: replace the line with the next older entry containing what was typed
+static int reverseSearch(int count, int key) {
+    long long found;
+
+    lock(LOCK_SH);
+    refresh();
+    if (searchShown == NULL || strcmp(rl_line_buffer, searchShown) != 0) {
+        free(searchQuery);
+        searchQuery = strdup(rl_line_buffer);
+        searchBefore = logLen;
+    }
+    found = histFind(searchQuery, searchBefore);
+    if (found == -1) {
+        lock(LOCK_UN);
+        rl_ding();
+        return 0;
+    }
+    free(searchShown);
+    searchShown = strndup(logMap + found, entryLen(found));
+    searchBefore = found;
+    lock(LOCK_UN);
+    rl_replace_line(searchShown, 0);
+    rl_point = rl_end;
+    return 0;
+}
+
+void histInit() {
+    const char* home = varGet("HOME");
+    size_t starts[HIST_RECENT];
+    size_t end;
+    int n = 0;
+
+    if (home == NULL) {
+        return;
+    }
+    logPath = pathFor(home, "");
+    idxPath = pathFor(home, ".idx");
+    lockPath = pathFor(home, ".lock");
+    lockFd = open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    logFd = open(logPath, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (logFd == -1) {
+        return;
+    }
+    refresh();
+    rl_bind_keyseq("\\C-r", reverseSearch);
+
+    // only the newest entries go to readline; the rest stay in the map
+    end = logLen;
+    while (end > 0 && n < HIST_RECENT) {
+        size_t stop = end - (logMap[end - 1] == '\n');
+        char* nl = stop > 0 ? memrchr(logMap, '\n', stop) : NULL;
+        starts[n++] = nl != NULL ? (size_t)(nl + 1 - logMap) : 0;
+        end = starts[n - 1];
+    }
+    while (n-- > 0) {
+        char* entry = strndup(logMap + starts[n], entryLen(starts[n]));
+        add_history(entry);
+        free(lastLine);
+        lastLine = entry;
+    }
+}
+
+void histAppend(const char* line) {
+    size_t len = strlen(line);
+
+    if (len == 0 || line[0] == ' ' || strchr(line, '\n') != NULL ||
+        (lastLine != NULL && strcmp(line, lastLine) == 0)) {
+        return;
+    }
+    free(lastLine);
+    lastLine = strdup(line);
+    add_history(line);
+    if (logFd == -1) {
+        return;
+    }
+
+    char* rec = malloc(len + 1);
+    memcpy(rec, line, len);
+    rec[len] = '\n';
+    lock(LOCK_SH);
+    refresh();  // a compaction may have replaced the log
+    if (write(logFd, rec, len + 1) < 0) {
+        // history is best effort
+    }
+    lock(LOCK_UN);
+    free(rec);
+}
+
+/*
+ * Compaction
+ */
+
+typedef struct tricount {
+    uint32_t key;
+    uint32_t count;
+} tricount_t;
+
+static size_t pow2Above(size_t n) {
+    size_t p = 16;
+    while (p < n) {
+        p *= 2;
+    }
+    return p;
+}
+
+static int cmpKey(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// distinct trigram keys of s, sorted, into *keys; returns how many
+static size_t entryTrigrams(const char* s, size_t len, uint32_t** keys, size_t* cap) {
+    size_t i, n = 0;
+
+    if (len < 3) {
+        return 0;
+    }
+    if (len - 2 > *cap) {
+        *cap = len - 2;
+        *keys = realloc(*keys, *cap * sizeof(uint32_t));
+    }
+    for (i = 0; i + 3 <= len; i++) {
+        (*keys)[i] = trigramKey(s + i);
+    }
+    if (len - 2 <= 32) {   // the common case: a short line
+        for (i = 1; i < len - 2; i++) {
+            uint32_t k = (*keys)[i];
+            size_t j = i;
+            while (j > 0 && (*keys)[j - 1] > k) {
+                (*keys)[j] = (*keys)[j - 1];
+                j--;
+            }
+            (*keys)[j] = k;
+        }
+    } else {
+        qsort(*keys, len - 2, sizeof(uint32_t), cmpKey);
+    }
+    for (i = 0; i < len - 2; i++) {
+        if (n == 0 || (*keys)[n - 1] != (*keys)[i]) {
+            (*keys)[n++] = (*keys)[i];
+        }
+    }
+    return n;
+}
+
+static uint64_t bucketOf(hist_bucket_t* table, uint64_t nb, uint32_t key) {
+    uint64_t i = (key * 2654435761u) & (nb - 1);
+    while (table[i].key != 0 && table[i].key != key) {
+        i = (i + 1) & (nb - 1);
+    }
+    return i;
+}
+
+static int writeAll(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static uint64_t hashLine(const char* s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    while (len-- > 0) {
+        h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// with the exclusive lock held: write the deduplicated log and its index
+static long long compactLocked() {
+    size_t nlines = 0, capLines = 0, i, kept = 0;
+    size_t* offs = NULL;
+    size_t end;
+
+    if (logMap == NULL) {
+        return 0;
+    }
+
+    // every entry, oldest first
+    for (i = 0; i < logLen; i = end + 1) {
+        char* nl = memchr(logMap + i, '\n', logLen - i);
+        end = nl != NULL ? (size_t)(nl - logMap) : logLen;
+        if (end == i) {
+            continue;
+        }
+        if (nlines == capLines) {
+            capLines = capLines ? capLines * 2 : 1024;
+            offs = realloc(offs, capLines * sizeof(size_t));
+        }
+        offs[nlines++] = i;
+    }
+
+    // keep the newest copy of each entry: walk newest first through a set
+    size_t setSize = pow2Above(nlines * 2);
+    size_t* set = malloc(setSize * sizeof(size_t));
+    char* keep = calloc(nlines ? nlines : 1, 1);
+    memset(set, 0xff, setSize * sizeof(size_t));
+    for (i = nlines; i-- > 0;) {
+        size_t len = entryLen(offs[i]);
+        size_t slot = hashLine(logMap + offs[i], len) & (setSize - 1);
+        while (set[slot] != (size_t)-1) {
+            size_t o = offs[set[slot]];
+            if (entryLen(o) == len && memcmp(logMap + o, logMap + offs[i], len) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (setSize - 1);
+        }
+        if (set[slot] == (size_t)-1) {
+            set[slot] = i;
+            keep[i] = 1;
+            kept++;
+        }
+    }
+    free(set);
+
+    // the new log, and where each kept entry lands in it
+    char* tmpLog = pathFor(varGet("HOME") ? varGet("HOME") : ".", ".tmp");
+    int fd = open(tmpLog, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    uint64_t* newOff = malloc((kept ? kept : 1) * sizeof(uint64_t));
+    uint64_t pos = 0;
+    size_t k = 0;
+    int ok = fd != -1;
+    for (i = 0; ok && i < nlines; i++) {
+        if (keep[i]) {
+            size_t len = entryLen(offs[i]) + 1;
+            newOff[k++] = pos;
+            if (offs[i] + len > logLen) {   // an unterminated last entry
+                ok = writeAll(fd, logMap + offs[i], len - 1) == 0 && writeAll(fd, "\n", 1) == 0;
+            } else {
+                ok = writeAll(fd, logMap + offs[i], len) == 0;
+            }
+            pos += len;
+        }
+    }
+
+    // count the trigrams of the kept entries
+    uint32_t* keys = NULL;
+    size_t capKeys = 0, nkeys, j;
+    size_t ndistinct = 0, npost = 0;
+    uint64_t nb = 16;
+    hist_bucket_t* table = calloc(nb, sizeof(hist_bucket_t));
+    for (i = 0; ok && i < nlines; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        nkeys = entryTrigrams(logMap + offs[i], entryLen(offs[i]), &keys, &capKeys);
+        for (j = 0; j < nkeys; j++) {
+            if ((ndistinct + 1) * 2 > nb) {     // grow and rehash at half full
+                hist_bucket_t* grown = calloc(nb * 2, sizeof(hist_bucket_t));
+                uint64_t b;
+                for (b = 0; b < nb; b++) {
+                    if (table[b].key != 0) {
+                        grown[bucketOf(grown, nb * 2, table[b].key)] = table[b];
+                    }
+                }
+                free(table);
+                table = grown;
+                nb *= 2;
+            }
+            uint64_t b = bucketOf(table, nb, keys[j]);
+            if (table[b].key == 0) {
+                table[b].key = keys[j];
+                ndistinct++;
+            }
+            table[b].count++;
+            npost++;
+        }
+    }
+
+    // lay the postings out per trigram, then fill them in entry order
+    uint64_t b, at = 0;
+    uint32_t* fill = calloc(nb, sizeof(uint32_t));
+    uint32_t* post = malloc((npost ? npost : 1) * sizeof(uint32_t));
+    for (b = 0; b < nb; b++) {
+        table[b].off = at;
+        at += table[b].count;
+    }
+    for (i = 0, k = 0; ok && i < nlines; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        nkeys = entryTrigrams(logMap + offs[i], entryLen(offs[i]), &keys, &capKeys);
+        for (j = 0; j < nkeys; j++) {
+            b = bucketOf(table, nb, keys[j]);
+            post[table[b].off + fill[b]++] = k;
+        }
+        k++;
+    }
+
+    struct stat st;
+    hist_index_t hdr;
+    char* tmpIdx = pathFor(varGet("HOME") ? varGet("HOME") : ".", ".idx.tmp");
+    int ifd = ok ? open(tmpIdx, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : -1;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, HIST_MAGIC, sizeof(HIST_MAGIC));
+    hdr.indexedLen = pos;
+    hdr.nentries = kept;
+    hdr.nbuckets = nb;
+    hdr.npostings = npost;
+    ok = ok && ifd != -1 && fstat(fd, &st) == 0;
+    hdr.logIno = ok ? st.st_ino : 0;
+    ok = ok && writeAll(ifd, &hdr, sizeof(hdr)) == 0 &&
+         writeAll(ifd, newOff, kept * sizeof(uint64_t)) == 0 &&
+         writeAll(ifd, table, nb * sizeof(hist_bucket_t)) == 0 &&
+         writeAll(ifd, post, npost * sizeof(uint32_t)) == 0;
+
+    // the index names the new log's inode, so either order of renames is safe
+    ok = ok && rename(tmpIdx, idxPath) == 0 && rename(tmpLog, logPath) == 0;
+    if (!ok) {
+        unlink(tmpIdx);
+        unlink(tmpLog);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (ifd != -1) {
+        close(ifd);
+    }
+    free(tmpLog);
+    free(tmpIdx);
+    free(fill);
+    free(post);
+    free(table);
+    free(keys);
+    free(newOff);
+    free(keep);
+    free(offs);
+    return ok ? (long long)kept : -1;
+}
+
+long long histCompact() {
+    long long kept;
+
+    if (logFd == -1) {
+        return -1;
+    }
+    lock(LOCK_EX);
+    refresh();
+    kept = compactLocked();
+    refresh();
+    lock(LOCK_UN);
+    return kept;
+}
+
+void histClose() {
+    size_t indexed;
+
+    if (logFd == -1) {
+        return;
+    }
+    refresh();
+    indexed = idx != NULL ? idx->indexedLen : 0;
+    // let a child bring the index up to date; the shell exits right away
+    if (logLen - indexed > HIST_INDEX_SLACK && fork() == 0) {
+        histCompact();
+        _exit(0);
+    }
+    unmapIndex();
+    mapLog(0);
+    close(logFd);
+    logFd = -1;
+    if (lockFd != -1) {
+        close(lockFd);
+        lockFd = -1;
+    }
+}
+
+void historyCommand(int argc, char** argv) {
+    int count = HIST_SHOW;
+    long long found;
+    size_t before;
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        found = histCompact();
+        if (found == -1) {
+            fprintf(stderr, HIST_ERR);
+        } else {
+            printf("history: %lld entries\n", found);
+        }
+        return;
+    }
+
+    lock(LOCK_SH);
+    refresh();
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+        // the words after -s are the text; newest matches first
+        size_t len = 0;
+        int i;
+        for (i = 2; i < argc; i++) {
+            len += strlen(argv[i]) + 1;
+        }
+        char* query = malloc(len);
+        query[0] = '\0';
+        for (i = 2; i < argc; i++) {
+            strcat(query, argv[i]);
+            if (i + 1 < argc) {
+                strcat(query, " ");
+            }
+        }
+        before = logLen;
+        while (count-- > 0 && (found = histFind(query, before)) != -1) {
+            printf("%.*s\n", (int)entryLen(found), logMap + found);
+            before = found;
+        }
+        free(query);
+    } else {
+        // the last count entries, oldest first
+        if (argc > 1) {
+            count = atoi(argv[1]);
+        }
+        before = logLen;
+        while (count > 0 && before > 0) {
+            size_t stop = before - (logMap[before - 1] == '\n');
+            char* nl = stop > 0 ? memrchr(logMap, '\n', stop) : NULL;
+            before = nl != NULL ? (size_t)(nl + 1 - logMap) : 0;
+            count--;
+        }
+        while (before < logLen) {
+            size_t len = entryLen(before);
+            printf("%.*s\n", (int)len, logMap + before);
+            before += len + 1;
+        }
+    }
+    lock(LOCK_UN);
+}
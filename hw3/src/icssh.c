@@ -1,14 +1,34 @@
 #include "icssh.h"
 #include "linkedList.h"
 #include "helpers.h"
+#include "bgtop.h"
+#include "capture.h"
+#include "cmdlist.h"
+#include "complete.h"
+#include "daemon.h"
+#include "events.h"
+#include "histfile.h"
+#include "jobopts.h"
+#include "jobtable.h"
+#include "memo.h"
+#include "metrics.h"
+#include "pathglob.h"
+#include "pipestat.h"
+#include "record.h"
+#include "timers.h"
+#include "trace.h"
+#include "vars.h"
 #include <readline/readline.h>
 #include <signal.h>
 #include <stdio.h>
+#include <errno.h>
 
 int killChildFlag = 0;
 
 void sigchild_handler(int status) {
     killChildFlag = 1;
+    TRACE(TRACE_SIGCHLD, -1, 0);
+    metricsSigchld();
 }
 
 void sigusr2_handler(int status) {
@@ -18,18 +38,57 @@ void sigusr2_handler(int status) {
 }
 
 int main(int argc, char* argv[]) {
+	// one-shot mode: run a single command line and exit with its status,
+	// skipping readline and the signal handlers entirely
+	if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+		return runCommandString(argv[2]);
+	}
+
+	// server mode: run the lines of many clients on one event loop
+	if (argc == 3 && strcmp(argv[1], "--listen") == 0) {
+		return daemonServe(argv[2]);
+	}
+
 	char* line;
-	int exec_result;
-	int exit_status;
+	int exit_status = 0;
+	int status = 0;		// of the last command, builtins included; decides && and ||
 	pid_t pid;
 	pid_t wait_result;
 	time_t receivedTime;
+	job_opts_t opts;
+	int limit;
 	sigset_t mask_all, mask_child, prev_mask;
+	char* replayFile = NULL;
+	int paced = 0;
+	int arg;
 
 	int inSaved = STDIN_FILENO;
 	int outSaved = STDOUT_FILENO;
 	int errSaved = STDERR_FILENO;
 
+	// session recording and replay, live metrics
+	for (arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "--record") == 0 && arg + 1 < argc) {
+			if (recordOpen(argv[++arg]) == -1) {
+				fprintf(stderr, RECORD_ERR, argv[arg]);
+				exit(EXIT_FAILURE);
+			}
+		} else if (strcmp(argv[arg], "--replay") == 0 && arg + 1 < argc) {
+			replayFile = argv[++arg];
+		} else if (strcmp(argv[arg], "--paced") == 0) {
+			paced = 1;
+		} else if (strcmp(argv[arg], "--metrics") == 0 && arg + 1 < argc) {
+			if (metricsOpen(argv[++arg]) == -1) {
+				fprintf(stderr, METRICS_ERR, argv[arg]);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	if (replayFile != NULL && replayOpen(replayFile, paced) == -1) {
+		fprintf(stderr, RECORD_ERR, replayFile);
+		exit(EXIT_FAILURE);
+	}
+
 	sigfillset(&mask_all);
 	sigemptyset(&mask_child);
 	sigaddset(&mask_child, SIGCHLD);
@@ -56,30 +115,76 @@ int main(int argc, char* argv[]) {
 	//create list for background processes
 	List_t* bgList = createList(&bgentryComparator);
 
+	// keep the event loop (background output capture) running at the prompt
+	rl_getc_function = eventGetc;
+	completeInit();
+	if (!replayActive()) {  // a replayed session stays out of the history
+		histInit();
+	}
+	// pick up the background jobs an earlier shell left running
+	jobTableInit(bgList);
+
 
     // print the prompt & wait for the user to enter commands string
-	while ((line = readline(SHELL_PROMPT)) != NULL) {
+	// lines are split into their pipelines, which are run one at a time
+	while ((line = cmdNextLine(SHELL_PROMPT, status, bgList)) != NULL) {
+		status = 0;
+
+		// expansions of the previous line are no longer needed
+		globReset();
 
 		// remove terminated processes from list if flag is set
 		if (killChildFlag) {
 			// kill only terminated bg processes
 			while((pid = waitpid(-1, &exit_status, WNOHANG)) > 0) {
-				removeByPID(bgList, pid);
+				TRACE(TRACE_EXIT, pid, exit_status);
+				metricsReaped();
+				if ((limit = timerCancel(pid)) > 0) {
+					printf(TIMEOUT_MSG, pid, limit);
+				}
+				// a pipeline is done once its last running stage is reaped
+				bgentry_t* owner = findByPID(bgList, pid);
+				if (owner == NULL || stageReaped(owner, pid) > 0) {
+					continue;
+				}
+				removeByPID(bgList, owner->pid);
 			}
 			killChildFlag = 0;
+			metricsReapDone();
 		}
+		// adopted jobs are not children; their pidfds tell when they end
+		jobTableReap(bgList);
+		METRIC_SET(bgActive, bgList->length);
 
 		time(&receivedTime);
 
         // MAGIC HAPPENS! Command string is parsed into a job struct
         // Will print out error message if command string is invalid
+		uint64_t parseStart = metricsNow();
 		job_info* job = validate_input(line);
+		metricsParsed(parseStart);
         if (job == NULL) { // Command was empty string or invalid
+			if (strspn(line, " \t\n") != strlen(line)) {
+				status = 2 << 8;
+			}
 			free(line);
 			line = NULL;
 			continue;
 		}
 
+		TRACE(TRACE_PARSE, getpid(), job->nproc);
+
+		// strip prefixes such as `timeout <secs>` off the command
+		if (stripJobOpts(job, &opts) == -1) {
+			status = 2 << 8;
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// expand $VAR, then *, ?, [...] and ** in the arguments
+		expandVars(job);
+		expandJob(job);
+
         //Prints out the job linked list struture for debugging
         #ifdef DEBUG   // If DEBUG flag removed in makefile, this will not longer print
             debug_print_job(job);
@@ -88,9 +193,18 @@ int main(int argc, char* argv[]) {
 		
 		// exit shell
 		if (strcmp(job->procs->cmd, "exit") == 0) {
+			cmdExitGroup(job);	// only leaves a ( ... ) group's process
+			jobTableDetach(bgList);
+			jobTableClose();
 			deleteList(&bgList);
 			free(bgList);
 			bgList = NULL;
+			captureFreeAll();
+			bgtopClose();
+			completeClose();
+			histClose();
+			recordLineDone(exitCode(status));
+			recordClose();
 			//Terminating the shell
 			freeAndNull(job, line);
             validate_input(NULL);   // calling validate_input with NULL will free the memory it has allocated
@@ -100,7 +214,9 @@ int main(int argc, char* argv[]) {
 		// Change working directory
 		if (strcmp(job->procs->cmd, "cd") == 0) {
 			// change directorory
-			changeDir(job);
+			if (changeDir(job) == -1) {
+				status = EXIT_FAILURE << 8;
+			}
 			freeAndNull(job, line);
 			continue;
 		}
@@ -126,10 +242,138 @@ int main(int argc, char* argv[]) {
 			continue;
 		}
 
+		// toggle capture of background job output
+		if (strcmp(job->procs->cmd, "bgcapture") == 0) {
+			if (job->procs->argc > 1) {
+				captureEnabled = strcmp(job->procs->argv[1], "off") != 0;
+			}
+			printf("bgcapture %s\n", captureEnabled ? "on" : "off");
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// print captured output of a background process
+		if (strcmp(job->procs->cmd, "bgout") == 0) {
+			if (job->procs->argc < 2) {
+				fprintf(stderr, PID_ERR);
+			} else {
+				pid_t outPid = atoi(job->procs->argv[1]);
+				int follow = job->procs->argc > 2 && strcmp(job->procs->argv[2], "-f") == 0;
+				if (captureShow(bgList, outPid, follow) == -1) {
+					fprintf(stderr, BGOUT_ERR, outPid);
+				}
+			}
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// job lifecycle tracing: trace on|off|flush [-b] [file]
+		if (strcmp(job->procs->cmd, "trace") == 0) {
+			traceCommand(job);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// set and export shell variables
+		if (strcmp(job->procs->cmd, "export") == 0) {
+			exportCommand(job->procs);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		if (strcmp(job->procs->cmd, "unset") == 0) {
+			unsetCommand(job->procs);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// print, search (-s) or compact (-c) the persistent history
+		if (strcmp(job->procs->cmd, "history") == 0) {
+			historyCommand(job->procs->argc, job->procs->argv);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// keep directory listings for globbing across lines
+		if (strcmp(job->procs->cmd, "globcache") == 0) {
+			if (job->procs->argc > 1) {
+				globCacheLines = strcmp(job->procs->argv[1], "off") != 0;
+			}
+			printf("globcache %s\n", globCacheLines ? "on" : "off");
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// show CPU, memory and state of the background jobs
+		if (strcmp(job->procs->cmd, "bgtop") == 0) {
+			int interval = job->procs->argc > 1 ? atoi(job->procs->argv[1]) : 0;
+			int count = job->procs->argc > 2 ? atoi(job->procs->argv[2]) : 0;
+			bgtop(bgList, interval, count);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// set the default time limit of background jobs
+		if (strcmp(job->procs->cmd, "bgtimeout") == 0) {
+			if (job->procs->argc > 1) {
+				bgTimeout = atoi(job->procs->argv[1]);
+			}
+			printf("bgtimeout %d\n", bgTimeout);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// statistics and limits of the memo store
+		if (strcmp(job->procs->cmd, "memo") == 0) {
+			memoCommand(job);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// a memo prefix: replay an identical earlier run, or run and keep it
+		if (opts.memo) {
+			exit_status = status = memoRun(job, line, &opts);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// set the capacity of the pipes between pipeline stages
+		if (strcmp(job->procs->cmd, "pipesize") == 0) {
+			if (job->procs->argc > 1 && setPipeSize(atoi(job->procs->argv[1])) == -1) {
+				fprintf(stderr, PIPESIZE_ERR, job->procs->argv[1]);
+			}
+			printf("pipesize %d\n", pipeSize);
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// measure the throughput of every pipeline
+		if (strcmp(job->procs->cmd, "pipestat") == 0) {
+			if (job->procs->argc > 1) {
+				pipeStatEnabled = strcmp(job->procs->argv[1], "off") != 0;
+			}
+			printf("pipestat %s\n", pipeStatEnabled ? "on" : "off");
+			freeAndNull(job, line);
+			continue;
+		}
+
+		// keep background jobs running past exit and crashes
+		if (strcmp(job->procs->cmd, "bgpersist") == 0) {
+			bgpersistCommand(job, bgList);
+			freeAndNull(job, line);
+			continue;
+		}
+
 		// Execute piping
 		if (job->nproc > 1) {
-			piping(job, line, bgList);
-			if(!job->bg){
+			int pipeStatus = piping(job, line, bgList, &opts);
+			if (pipeStatus == -1) {
+				status = 2 << 8;
+			} else if (!job->bg) {
+				exit_status = status = pipeStatus;
+			}
+			// a background job now belongs to bgList, unless it never started
+			if (!job->bg || pipeStatus == -1) {
 				free_job(job);
 				job = NULL;
 			}
@@ -138,9 +382,13 @@ int main(int argc, char* argv[]) {
 			continue;
 		}
 
+		capture_t* cap = job->bg ? captureOpen(job) : NULL;
+
 		// block sigchild
 		sigprocmask(SIG_BLOCK, &mask_child, &prev_mask);
 
+		char** envp = varsEnviron();	// in the shell, so its cache is kept
+		uint64_t spawnStart = metricsNow();
 		if ((pid = fork()) < 0) {
 			exit(EXIT_FAILURE);
 		}
@@ -148,59 +396,49 @@ int main(int argc, char* argv[]) {
 			// unblock sigchild
 			sigprocmask(SIG_SETMASK, &prev_mask, NULL);
 
-			// error checking for file redirection
-			if (redirectionCheck(job) == -1) {
-				fprintf(stderr, RD_ERR);
-                freeAndNull(job, line);
-				exit(EXIT_FAILURE);
-			}
-
-			// perform file redirection
-			if(job->in_file != NULL) {
-				if((inSaved = openIn(job, line)) == -1) {
-					validate_input(NULL);
-					exit(EXIT_FAILURE);
-				}
-			}
-
-			if (job->out_file != NULL) {
-				outSaved = openOut(job, line);
-			}
-
-			if (job->procs->err_file != NULL) {
-				errSaved = openErr(job, line);
+			// redirect, apply the prefixes and exec; only returns to exit
+			execJob(job, line, &opts, cap, envp);
+		} else {
+			TRACE(TRACE_SPAWN, pid, 0);
+			metricsSpawned(spawnStart);
+			if (opts.timeout > 0) {
+				timerArm(pid, timerDeadline(opts.timeout), opts.timeout);
 			}
 
-            // get the first command in the job list
-		    proc_info* proc = job->procs;
-			exec_result = execvp(proc->cmd, proc->argv);
-
-			if (exec_result < 0) {  //Error checking
-				printf(EXEC_ERR, proc->cmd);
-				
-				// Cleaning up to make Valgrind happy 
-				// (not necessary because child will exit. Resources will be reaped by parent)
-				freeAndNull(job, line);
-				validate_input(NULL);  // calling validate_input with NULL will free the memory it has allocated
-				exit(EXIT_FAILURE);
-			}
-		} else {
-			
 			if (job->bg) { // if job is a background process
 				sigprocmask(SIG_BLOCK, &mask_all, NULL);
 				bgentry_t* bgEnt = createBGEntry(job, pid, receivedTime);
+				if (cap != NULL) {
+					cap->pid = pid;
+					captureCloseWriters(cap);
+					bgEnt->capture = cap;
+				}
+				if (hasJobOpts(&opts)) {
+					bgEnt->opts = malloc(sizeof(job_opts_t));
+					memcpy(bgEnt->opts, &opts, sizeof(job_opts_t));
+				}
 				insertInOrder(bgList, bgEnt);
+				jobTableAdd(bgList, bgEnt);
+				METRIC_SET(bgActive, bgList->length);
 				sigprocmask(SIG_SETMASK, &prev_mask, NULL);
 				
 			} else {
 
 				// As the parent, wait for the foreground job to finish
-				wait_result = waitpid(pid, &exit_status, 0);
+				wait_result = waitForeground(pid, &exit_status);
 
 				if (wait_result < 0) {
 					printf(WAIT_ERR);
 					exit(EXIT_FAILURE);
 				}
+				TRACE(TRACE_EXIT, pid, exit_status);
+
+				// record the timeout as the job's exit status
+				if (timerCancel(pid) > 0) {
+					printf(TIMEOUT_MSG, pid, opts.timeout);
+					exit_status = TIMEOUT_STATUS << 8;
+				}
+				status = exit_status;
 			}
 			sigprocmask(SIG_SETMASK, &prev_mask, NULL);
 		}
@@ -230,11 +468,16 @@ int main(int argc, char* argv[]) {
 		line = NULL;
 	}
 
+    recordLineDone(exitCode(status));
+    recordClose();
+
     // calling validate_input with NULL will free the memory it has allocated
     validate_input(NULL);
 
 #ifndef GS
-	fclose(rl_outstream);
+	if (rl_outstream != NULL) {     // never set up when the lines were replayed
+		fclose(rl_outstream);
+	}
 #endif
 	return 0;
 }
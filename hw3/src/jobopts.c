@@ -0,0 +1,308 @@
+#include "jobopts.h"
+#include "timers.h"
+#include "pipestat.h"
+#include <errno.h>
+
+typedef struct limit_flag {
+    char* flag;
+    int resource;
+    rlim_t unit;
+} limit_flag_t;
+
+// ulimit flags understood by the ulimit prefix; sizes are given in KiB
+static limit_flag_t limitFlags[] = {
+    {"-t", RLIMIT_CPU, 1},
+    {"-v", RLIMIT_AS, 1024},
+    {"-f", RLIMIT_FSIZE, 1024},
+    {"-c", RLIMIT_CORE, 1024},
+    {"-n", RLIMIT_NOFILE, 1},
+    {"-u", RLIMIT_NPROC, 1},
+};
+
+#define NLIMIT_FLAGS (sizeof(limitFlags) / sizeof(limitFlags[0]))
+
+// drop the first n words of argv; the strings belong to the parser
+static void shiftArgs(proc_info* proc, int n) {
+    memmove(proc->argv, proc->argv + n, (proc->argc - n + 1) * sizeof(char*));
+    proc->argc -= n;
+    proc->cmd = proc->argv[0];
+}
+
+// parse an integer argument within [min, max]; returns -1 if it is not one
+static int parseInt(char* s, long min, long max, long* out) {
+    char* end;
+
+    if (s == NULL) {
+        return -1;
+    }
+    errno = 0;
+    *out = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || errno != 0 || *out < min || *out > max) {
+        return -1;
+    }
+    return 0;
+}
+
+// parse a cpu list such as "0-3,8,10-11"
+static int parseCpus(char* s, cpu_set_t* cpus) {
+    char* end;
+    long lo, hi;
+
+    CPU_ZERO(cpus);
+    while (*s != '\0') {
+        lo = hi = strtol(s, &end, 10);
+        if (end == s) {
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s) {
+                return -1;
+            }
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (; lo <= hi; lo++) {
+            CPU_SET(lo, cpus);
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        s = end;
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+static int parseLimit(char* flag, char* value, job_opts_t* opts) {
+    long v;
+    size_t i;
+
+    if (opts->nlimits == JOBOPTS_MAX_LIMITS || flag == NULL) {
+        return -1;
+    }
+    for (i = 0; i < NLIMIT_FLAGS; i++) {
+        if (strcmp(flag, limitFlags[i].flag) == 0) {
+            break;
+        }
+    }
+    if (i == NLIMIT_FLAGS || parseInt(value, 0, 0x7fffffff, &v) == -1) {
+        return -1;
+    }
+    opts->limits[opts->nlimits].resource = limitFlags[i].resource;
+    opts->limits[opts->nlimits].value = (rlim_t)v * limitFlags[i].unit;
+    opts->nlimits++;
+    return 0;
+}
+
+// strip prefixes off proc into opts; the prefix name is reported on error
+static int parseOpts(proc_info* proc, job_opts_t* opts) {
+    long v;
+
+    while (proc->argc > 0) {
+        char* name = proc->cmd;
+        int used;
+
+        if (strcmp(name, "timeout") == 0) {
+            used = 2;
+            if (parseInt(proc->argv[1], 0, 0x7fffffff, &v) == 0) {
+                opts->timeout = (int)v;
+            } else {
+                used = -1;
+            }
+        } else if (strcmp(name, "affinity") == 0) {
+            used = 2;
+            if (proc->argv[1] == NULL || parseCpus(proc->argv[1], &opts->cpus) == -1) {
+                used = -1;
+            }
+            opts->hasAffinity = 1;
+        } else if (strcmp(name, "priority") == 0) {
+            used = 2;
+            if (parseInt(proc->argv[1], -20, 19, &v) == 0) {
+                opts->hasNice = 1;
+                opts->nice = (int)v;
+            } else {
+                used = -1;
+            }
+        } else if (strcmp(name, "sched") == 0) {
+            used = 2;
+            if (proc->argv[1] == NULL) {
+                used = -1;
+            } else if (strcmp(proc->argv[1], "batch") == 0) {
+                opts->policy = SCHED_BATCH;
+            } else if (strcmp(proc->argv[1], "idle") == 0) {
+                opts->policy = SCHED_IDLE;
+            } else if (strcmp(proc->argv[1], "other") == 0) {
+                opts->policy = SCHED_OTHER;
+            } else {
+                used = -1;
+            }
+        } else if (strcmp(name, "ulimit") == 0) {
+            used = 3;
+            if (proc->argc < 3 || parseLimit(proc->argv[1], proc->argv[2], opts) == -1) {
+                used = -1;
+            }
+        } else if (strcmp(name, "pipesize") == 0) {
+            if (proc->argc <= 2) {
+                return 0;   // nothing to apply it to: the pipesize builtin
+            }
+            used = 2;
+            if (parseInt(proc->argv[1], 1, 0x7fffffff, &v) == 0) {
+                opts->pipeSize = (int)v;
+            } else {
+                used = -1;
+            }
+        } else if (strcmp(name, "pipestat") == 0) {
+            if (proc->argc == 1 || (proc->argc == 2 && (strcmp(proc->argv[1], "on") == 0 ||
+                                                         strcmp(proc->argv[1], "off") == 0))) {
+                return 0;   // the pipestat builtin
+            }
+            used = 1;
+            opts->pipeStat = 1;
+        } else if (strcmp(name, "memo") == 0) {
+            if (proc->argc == 1 || proc->argv[1][0] == '-') {
+                return 0;   // the memo builtin
+            }
+            used = 1;
+            opts->memo = 1;
+        } else {
+            return 0;
+        }
+
+        // a prefix must be followed by the command it applies to
+        if (used == -1 || proc->argc <= used) {
+            fprintf(stderr, OPT_ERR, name);
+            return -1;
+        }
+        shiftArgs(proc, used);
+    }
+    return -1;
+}
+
+int stripJobOpts(job_info* job, job_opts_t* opts) {
+    memset(opts, 0, sizeof(job_opts_t));
+    opts->timeout = -1;
+    opts->policy = POLICY_INHERIT;
+    opts->pipeSize = -1;
+    opts->pipeStat = -1;
+
+    if (parseOpts(job->procs, opts) == -1) {
+        return -1;
+    }
+    if (opts->timeout < 0) {
+        opts->timeout = job->bg ? bgTimeout : 0;
+    }
+    if (opts->memo && (job->bg || job->nproc > 1)) {
+        fprintf(stderr, OPT_ERR, "memo");
+        return -1;
+    }
+    if (opts->pipeSize < 0) {
+        opts->pipeSize = pipeSize;
+    }
+    if (opts->pipeStat < 0) {
+        opts->pipeStat = pipeStatEnabled;
+    }
+    return 0;
+}
+
+int stripStageOpts(proc_info* proc, job_opts_t* opts) {
+    return parseOpts(proc, opts);
+}
+
+int applyJobOpts(job_opts_t* opts) {
+    struct sched_param param;
+    struct rlimit rl;
+    int i;
+
+    if (opts->hasAffinity && sched_setaffinity(0, sizeof(cpu_set_t), &opts->cpus) == -1) {
+        fprintf(stderr, POLICY_ERR, "affinity");
+        return -1;
+    }
+    if (opts->policy != POLICY_INHERIT) {
+        memset(&param, 0, sizeof(param));
+        if (sched_setscheduler(0, opts->policy, &param) == -1) {
+            fprintf(stderr, POLICY_ERR, "sched");
+            return -1;
+        }
+    }
+    if (opts->hasNice && setpriority(PRIO_PROCESS, 0, opts->nice) == -1) {
+        fprintf(stderr, POLICY_ERR, "priority");
+        return -1;
+    }
+    for (i = 0; i < opts->nlimits; i++) {
+        rl.rlim_cur = rl.rlim_max = opts->limits[i].value;
+        if (setrlimit(opts->limits[i].resource, &rl) == -1) {
+            fprintf(stderr, POLICY_ERR, "ulimit");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int hasJobOpts(job_opts_t* opts) {
+    return opts->timeout > 0 || opts->hasAffinity || opts->hasNice ||
+           opts->policy != POLICY_INHERIT || opts->nlimits > 0 || opts->pipeSize > 0 || opts->pipeStat;
+}
+
+void formatJobOpts(job_opts_t* opts, char* buf, size_t size) {
+    size_t len = 0;
+    int cpu, i;
+    size_t f;
+
+    buf[0] = '\0';
+    if (opts->timeout > 0) {
+        len += snprintf(buf + len, size - len, "timeout %d ", opts->timeout);
+    }
+    if (opts->hasAffinity && len < size) {
+        char sep = ' ';
+        len += snprintf(buf + len, size - len, "affinity");
+        for (cpu = 0; cpu < CPU_SETSIZE && len < size; cpu++) {
+            int last = cpu;
+            if (!CPU_ISSET(cpu, &opts->cpus)) {
+                continue;
+            }
+            while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &opts->cpus)) {
+                last++;
+            }
+            if (last == cpu) {
+                len += snprintf(buf + len, size - len, "%c%d", sep, cpu);
+            } else {
+                len += snprintf(buf + len, size - len, "%c%d-%d", sep, cpu, last);
+            }
+            sep = ',';
+            cpu = last;
+        }
+        if (len < size) {
+            len += snprintf(buf + len, size - len, " ");
+        }
+    }
+    if (opts->hasNice && len < size) {
+        len += snprintf(buf + len, size - len, "priority %d ", opts->nice);
+    }
+    if (opts->policy != POLICY_INHERIT && len < size) {
+        len += snprintf(buf + len, size - len, "sched %s ",
+                        opts->policy == SCHED_BATCH ? "batch" : opts->policy == SCHED_IDLE ? "idle" : "other");
+    }
+    for (i = 0; i < opts->nlimits && len < size; i++) {
+        for (f = 0; f < NLIMIT_FLAGS; f++) {
+            if (limitFlags[f].resource == opts->limits[i].resource) {
+                len += snprintf(buf + len, size - len, "ulimit %s %lu ", limitFlags[f].flag,
+                                (unsigned long)(opts->limits[i].value / limitFlags[f].unit));
+                break;
+            }
+        }
+    }
+    if (opts->pipeSize > 0 && len < size) {
+        len += snprintf(buf + len, size - len, "pipesize %d ", opts->pipeSize);
+    }
+    if (opts->pipeStat && len < size) {
+        len += snprintf(buf + len, size - len, "pipestat ");
+    }
+    // drop the trailing separator
+    if (len > 0 && len < size) {
+        buf[len - 1] = '\0';
+    }
+}
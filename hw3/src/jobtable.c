@@ -0,0 +1,322 @@
+#include "jobtable.h"
+#include "events.h"
+#include "jobopts.h"
+#include "timers.h"
+#include "trace.h"
+#include "vars.h"
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// a stage of an adopted job, watched through its pidfd
+typedef struct adopted {
+    pid_t pid;
+    int pidfd;
+    int exited;
+    struct adopted* next;
+} adopted_t;
+
+static job_table_t* table = NULL;
+static int tableFd = -1;
+static List_t* tableList = NULL;    // the list the table mirrors
+static adopted_t* adopted = NULL;
+static int adoptedExited = 0;
+
+static char* tablePath() {
+    const char* home = varGet("HOME");
+    char* path;
+
+    if (home == NULL) {
+        return NULL;
+    }
+    path = malloc(strlen(home) + strlen(JOBTABLE_FILE) + 2);
+    sprintf(path, "%s/%s", home, JOBTABLE_FILE);
+    return path;
+}
+
+// when pid started, in clock ticks since boot; 0 if it is gone
+static uint64_t startTime(pid_t pid) {
+    char path[64];
+    char buf[1024];
+    unsigned long long start;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+
+    // comm may contain spaces and parentheses; the fields resume after the last ')'
+    char* close = strrchr(buf, ')');
+    if (close == NULL || sscanf(close + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u "
+                                           "%*d %*d %*d %*d %*d %*d %llu", &start) != 1) {
+        return 0;
+    }
+    return start;
+}
+
+// does this shell keep the table? not in a ( ... ) group's process
+static int owning() {
+    return table != NULL && table->owner == getpid();
+}
+
+static void adoptedReady(int fd, unsigned int events, void* arg) {
+    adopted_t* a = (adopted_t*)arg;
+
+    eventRemove(fd);
+    close(fd);
+    a->pidfd = -1;
+    a->exited = 1;
+    adoptedExited = 1;
+}
+
+// watch a stage left behind by an earlier shell; -1 if it is no longer that process
+static int adopt(pid_t pid, uint64_t start) {
+    adopted_t* a;
+    int pidfd;
+
+    if (pid <= 0 || startTime(pid) != start) {
+        return -1;
+    }
+    if ((pidfd = syscall(SYS_pidfd_open, pid, 0)) == -1) {
+        return -1;
+    }
+    a = calloc(1, sizeof(adopted_t));
+    a->pid = pid;
+    a->pidfd = pidfd;
+    a->next = adopted;
+    adopted = a;
+    eventAdd(pidfd, EPOLLIN, adoptedReady, a);
+    return 0;
+}
+
+static void adoptSlot(List_t* bgList, int i) {
+    job_slot_t* slot = &table->slots[i];
+    pid_t* pids;
+    int alive = 0;
+    int k;
+
+    // the file is only ours by convention; a slot that makes no sense is dropped
+    if (slot->nstages < 1 || slot->nstages > JOBTABLE_STAGES) {
+        slot->used = 0;
+        return;
+    }
+    pids = malloc(slot->nstages * sizeof(pid_t));
+    slot->line[JOBTABLE_LINE - 1] = '\0';
+    for (k = 0; k < slot->nstages; k++) {
+        pids[k] = adopt(slot->pids[k], slot->starts[k]) == 0 ? slot->pids[k] : 0;
+        alive += pids[k] != 0;
+    }
+
+    // it ended while no shell was watching
+    if (alive == 0) {
+        printf(BG_TERM, slot->pids[0], slot->line);
+        free(pids);
+        slot->used = 0;
+        return;
+    }
+
+    bgentry_t* entry = createBGEntry(createLineJob(slot->line), slot->pids[0], slot->seconds);
+    entry->pids = pids;
+    entry->nstages = slot->nstages;
+    entry->running = alive;
+    entry->slot = i;
+    if (slot->timeout > 0) {
+        long left = slot->seconds + slot->timeout - time(NULL);
+        entry->opts = calloc(1, sizeof(job_opts_t));
+        entry->opts->timeout = slot->timeout;
+        entry->opts->policy = POLICY_INHERIT;
+        for (k = 0; k < slot->nstages; k++) {
+            if (pids[k] != 0) {
+                timerArm(pids[k], timerDeadline(left > 0 ? left : 0), slot->timeout);
+            }
+        }
+    }
+    insertInOrder(bgList, entry);
+}
+
+// take the table over; adopt what an earlier shell left in it
+static int openTable(List_t* bgList, int create) {
+    char* path = tablePath();
+    int i;
+
+    if (path == NULL) {
+        return -1;
+    }
+    tableFd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+    free(path);
+    if (tableFd == -1) {
+        return -1;
+    }
+    if (flock(tableFd, LOCK_EX | LOCK_NB) == -1 || ftruncate(tableFd, sizeof(job_table_t)) == -1) {
+        close(tableFd);
+        tableFd = -1;
+        return -1;
+    }
+    table = mmap(NULL, sizeof(job_table_t), PROT_READ | PROT_WRITE, MAP_SHARED, tableFd, 0);
+    if (table == MAP_FAILED) {
+        table = NULL;
+        close(tableFd);
+        tableFd = -1;
+        return -1;
+    }
+    if (memcmp(table->magic, JOBTABLE_MAGIC, sizeof(table->magic)) != 0 || table->nslots != JOBTABLE_SLOTS) {
+        memset(table, 0, sizeof(job_table_t));
+        memcpy(table->magic, JOBTABLE_MAGIC, sizeof(table->magic));
+        table->nslots = JOBTABLE_SLOTS;
+    }
+    table->owner = getpid();
+    tableList = bgList;
+
+    for (i = 0; i < JOBTABLE_SLOTS; i++) {
+        if (table->slots[i].used) {
+            adoptSlot(bgList, i);
+        }
+    }
+    return 0;
+}
+
+void jobTableInit(List_t* bgList) {
+    openTable(bgList, 0);
+}
+
+void jobTableAdd(List_t* bgList, bgentry_t* entry) {
+    int nstages = entry->pids != NULL ? entry->nstages : 1;
+    job_slot_t* slot;
+    int i, k;
+
+    // captured or measured output flows through this shell; such jobs end with it
+    if (!owning() || bgList != tableList || nstages > JOBTABLE_STAGES ||
+        entry->capture != NULL || entry->stats != NULL) {
+        return;
+    }
+    for (i = 0; i < JOBTABLE_SLOTS && table->slots[i].used; i++)
+        ;
+    if (i == JOBTABLE_SLOTS) {
+        return;     // full: this one is not persisted
+    }
+    slot = &table->slots[i];
+    memset(slot, 0, sizeof(job_slot_t));
+    slot->nstages = nstages;
+    for (k = 0; k < nstages; k++) {
+        slot->pids[k] = entry->pids != NULL ? entry->pids[k] : entry->pid;
+        slot->starts[k] = startTime(slot->pids[k]);
+    }
+    slot->seconds = entry->seconds;
+    slot->timeout = entry->opts != NULL ? entry->opts->timeout : 0;
+    snprintf(slot->line, sizeof(slot->line), "%s", entry->job->line);
+    __atomic_store_n(&slot->used, 1, __ATOMIC_RELEASE);
+    entry->slot = i;
+}
+
+void jobTableRemove(bgentry_t* entry) {
+    if (owning() && entry->slot >= 0) {
+        __atomic_store_n(&table->slots[entry->slot].used, 0, __ATOMIC_RELEASE);
+        entry->slot = -1;
+    }
+}
+
+void jobTableReap(List_t* bgList) {
+    adopted_t** link = &adopted;
+    int limit;
+
+    if (!adoptedExited) {
+        return;
+    }
+    adoptedExited = 0;
+    while (*link != NULL) {
+        adopted_t* a = *link;
+        if (!a->exited) {
+            link = &a->next;
+            continue;
+        }
+        *link = a->next;
+        TRACE(TRACE_EXIT, a->pid, 0);
+        if ((limit = timerCancel(a->pid)) > 0) {
+            printf(TIMEOUT_MSG, a->pid, limit);
+        }
+        // same as a reaped child: done once its last running stage is
+        bgentry_t* owner = findByPID(bgList, a->pid);
+        if (owner != NULL && stageReaped(owner, a->pid) == 0) {
+            removeByPID(bgList, owner->pid);
+        }
+        free(a);
+    }
+}
+
+void jobTableDetach(List_t* bgList) {
+    node_t* node = bgList->head;
+    bgentry_t* entry;
+
+    if (!owning()) {
+        return;
+    }
+    while (node != NULL) {
+        entry = (bgentry_t*)node->value;
+        node = node->next;
+        if (entry->slot >= 0) {
+            printf(BG_DETACH, entry->pid, entry->job->line);
+            freeBGEntry(unlinkByPID(bgList, entry->pid));
+        }
+    }
+}
+
+void jobTableClose() {
+    if (table != NULL) {
+        munmap(table, sizeof(job_table_t));
+        table = NULL;
+    }
+    if (tableFd != -1) {
+        close(tableFd);     // the lock goes with the last descriptor
+        tableFd = -1;
+    }
+    tableList = NULL;
+}
+
+void jobTableForget() {
+    adopted_t* a;
+
+    jobTableClose();
+    while ((a = adopted) != NULL) {
+        adopted = a->next;
+        if (a->pidfd != -1) {
+            close(a->pidfd);
+        }
+        free(a);
+    }
+    adoptedExited = 0;
+}
+
+void bgpersistCommand(job_info* job, List_t* bgList) {
+    proc_info* proc = job->procs;
+    node_t* node;
+
+    if (proc->argc > 1 && strcmp(proc->argv[1], "on") == 0 && table == NULL) {
+        if (openTable(bgList, 1) == -1) {
+            fprintf(stderr, JOBS_ERR);
+        } else {
+            for (node = bgList->head; node != NULL; node = node->next) {
+                if (((bgentry_t*)node->value)->slot == -1) {
+                    jobTableAdd(bgList, (bgentry_t*)node->value);
+                }
+            }
+        }
+    } else if (proc->argc > 1 && strcmp(proc->argv[1], "off") == 0 && owning()) {
+        char* path = tablePath();
+        for (node = bgList->head; node != NULL; node = node->next) {
+            ((bgentry_t*)node->value)->slot = -1;
+        }
+        unlink(path);
+        free(path);
+        jobTableClose();
+    }
+    printf("bgpersist %s\n", owning() ? "on" : "off");
+}
@@ -1,5 +1,10 @@
 #include "linkedList.h"
 #include "icssh.h"
+#include "capture.h"
+#include "jobopts.h"
+#include "jobtable.h"
+#include "pipestat.h"
+#include "trace.h"
 /*
     What is a linked list?
     A linked list is a set of dynamically allocated nodes, arranged in
@@ -96,11 +101,7 @@ void* removeFront(List_t* list) {
     if (list->length == 0) {
         return NULL;
     }
-    bgentry_t* toDel = (bgentry_t*) (*head)->value;
-
-    free_job(toDel->job);
-    free(toDel);
-    toDel = NULL;
+    freeBGEntry((bgentry_t*) (*head)->value);
 
     next_node = (*head)->next;
     retval = (*head)->value;
@@ -117,45 +118,77 @@ void* removeFront(List_t* list) {
     return retval;
 }
 
+bgentry_t* unlinkByPID(List_t* list, pid_t pid) {
+    node_t** link = &(list->head);
+
+    while (*link != NULL && ((bgentry_t*)(*link)->value)->pid != pid) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        return NULL;
+    }
+
+    node_t* current = *link;
+    bgentry_t* entry = (bgentry_t*)current->value;
+    *link = current->next;
+    list->length--;
+    free(current);
+    return entry;
+}
+
+void freeBGEntry(bgentry_t* entry) {
+    captureRetire(entry->capture);
+    free(entry->opts);
+    free(entry->pids);
+    pipestatFree(entry->stats);
+    free_job(entry->job);
+    free(entry);
+}
+
 void removeByPID(List_t* list, int pid) {
-    node_t** head = &(list->head);
-    node_t* current = *head;
-    bgentry_t* currEntry = (bgentry_t*)current->value;
+    bgentry_t* currEntry = unlinkByPID(list, pid);
 
-    if (list->length == 0) {
-        currEntry = NULL;
+    if (currEntry == NULL) {
         return;
+    }
+    printf(BG_TERM, pid, currEntry->job->line);
+    jobTableRemove(currEntry);
+    if (currEntry->stats != NULL) {
+        pipestatFinish(currEntry->stats);
+        pipestatReport(currEntry->stats, stdout);
+    }
+    TRACE(TRACE_BG_TERM, pid, 0);
+    freeBGEntry(currEntry);
+}
 
-    } else if (list->length == 1) {
-        list->head = NULL;
-        list->length = 0;
-    } else {
-        if(currEntry->pid == pid) {
-            node_t* next_node = (*head)->next;
-            *head = next_node;
-            head = NULL;
-        } else {
-            node_t* prev = NULL;
-            int deleted = 0;
-
-            while(current != NULL && !deleted) {
-                prev = current;
-                current = current->next;
-                currEntry = (bgentry_t*)current->value;
-                if(currEntry->pid == pid) {
-                    prev->next = current->next;
-                    current->next = NULL;
-                    list->length--;
-                    deleted = 1;
-                }
+bgentry_t* findByPID(List_t* list, pid_t pid) {
+    node_t* current = list->head;
+    int i;
+
+    while (current != NULL) {
+        bgentry_t* entry = (bgentry_t*)current->value;
+        if (entry->pid == pid) {
+            return entry;
+        }
+        for (i = 0; entry->pids != NULL && i < entry->nstages; i++) {
+            if (entry->pids[i] == pid) {
+                return entry;
             }
         }
+        current = current->next;
     }
-    
-    free(current);
-    printf(BG_TERM, pid, currEntry->job->line);
-    free_job(currEntry->job);
-    free(currEntry);
+    return NULL;
+}
+
+int stageReaped(bgentry_t* entry, pid_t pid) {
+    int i;
+
+    for (i = 0; entry->pids != NULL && i < entry->nstages; i++) {
+        if (entry->pids[i] == pid) {
+            entry->pids[i] = 0;
+        }
+    }
+    return --entry->running;
 }
 
 void deleteList(List_t** list) {
@@ -165,11 +198,26 @@ void deleteList(List_t** list) {
     while ((*list)->head != NULL){
         bgentry_t* currEntry = (bgentry_t*)(*list)->head->value;
         printf(BG_TERM, currEntry->pid, currEntry->job->line);
+        jobTableRemove(currEntry);
         kill(currEntry->pid, SIGKILL);
+        for (int i = 1; currEntry->pids != NULL && i < currEntry->nstages; i++) {
+            if (currEntry->pids[i] > 0) {
+                kill(currEntry->pids[i], SIGKILL);
+            }
+        }
         removeFront(*list);
     }
 }
 
+void forgetList(List_t* list) {
+    while (list->head != NULL) {
+        bgentry_t* entry = (bgentry_t*)list->head->value;
+        captureForget(entry->capture);
+        entry->capture = NULL;
+        removeFront(list);
+    }
+}
+
 int bgentryComparator(const  void* bg1, const void* bg2) {
     bgentry_t* b1 = (bgentry_t*) bg1;
     bgentry_t * b2 = (bgentry_t*) bg2;
@@ -189,14 +237,42 @@ bgentry_t* createBGEntry(job_info *job, pid_t pid, time_t seconds) {
     newBG->job = job;
     newBG->pid = pid;
     newBG->seconds = seconds;
+    newBG->capture = NULL;
+    newBG->opts = NULL;
+    newBG->pids = NULL;
+    newBG->nstages = 1;
+    newBG->running = 1;
+    newBG->status = 0;
+    newBG->stats = NULL;
+    newBG->slot = -1;
 
     return newBG;
 }
 
+job_info* createLineJob(const char* line) {
+    job_info* job = calloc(1, sizeof(job_info));
+    job->line = strdup(line);
+    job->bg = true;
+    job->nproc = 1;
+    job->procs = calloc(1, sizeof(proc_info));
+    job->procs->argv = calloc(2, sizeof(char*));
+    job->procs->argv[0] = job->procs->cmd = "(";
+    job->procs->argc = 1;
+    return job;
+}
+
 void printList(List_t* list, char mode) {
     node_t* head = list->head;
+    char policy[256];
     while(head != NULL) {
-        print_bgentry(head->value);
+        bgentry_t* entry = (bgentry_t*)head->value;
+        print_bgentry(entry);
+        // print_bgentry only knows the basics; add the applied policy
+        if (entry->opts != NULL) {
+            formatJobOpts(entry->opts, policy, sizeof(policy));
+            fprintf(stderr, "\t%s\n", policy);
+        }
+        pipestatReport(entry->stats, stderr);
         head = head->next;
     }
 }
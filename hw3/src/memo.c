@@ -0,0 +1,490 @@
+#include "memo.h"
+#include "events.h"
+#include "helpers.h"
+#include "metrics.h"
+#include "timers.h"
+#include "trace.h"
+#include "vars.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+
+#define MEMO_KEY_LEN 32     // hex digits of the 128-bit key
+#define MEMO_BUF 65536
+
+typedef unsigned __int128 hash128_t;
+
+// FNV-1a, 128-bit
+#define FNV128_PRIME (((hash128_t)1 << 88) + 0x13b)
+#define FNV128_OFFSET (((hash128_t)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+
+typedef struct memo_entry {
+    char name[MEMO_KEY_LEN + 1];
+    off_t size;
+    struct timespec used;
+} memo_entry_t;
+
+struct memo_run;
+
+// one output stream of a run being stored
+typedef struct memo_stream {
+    uint32_t fd;            // STDOUT_FILENO or STDERR_FILENO
+    int dst;                // where the output goes this time
+    uint64_t* bytes;
+    struct memo_run* run;
+} memo_stream_t;
+
+typedef struct memo_run {
+    memo_header_t hdr;
+    int store;              // the entry being written, -1 once given up on
+    char* tmp;              // its temporary name
+    uint64_t stored;
+    int open;               // output pipes not yet at EOF
+} memo_run_t;
+
+static long long memoMax = MEMO_MAX_DEFAULT;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+static unsigned long long savedNs = 0;
+
+static unsigned long long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int writeAll(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void hashBytes(hash128_t* h, const void* buf, size_t len) {
+    const unsigned char* p = buf;
+    while (len-- > 0) {
+        *h = (*h ^ *p++) * FNV128_PRIME;
+    }
+}
+
+// the terminating NUL keeps "ab" "c" apart from "a" "bc"
+static void hashStr(hash128_t* h, const char* s) {
+    hashBytes(h, s, strlen(s) + 1);
+}
+
+// identify a file by where it is and when it last changed, not by reading it
+static int hashFile(hash128_t* h, const char* path) {
+    struct stat st;
+    uint64_t id[5];
+
+    if (stat(path, &st) == -1) {
+        return -1;
+    }
+    id[0] = st.st_dev;
+    id[1] = st.st_ino;
+    id[2] = st.st_size;
+    id[3] = st.st_mtim.tv_sec;
+    id[4] = st.st_mtim.tv_nsec;
+    hashStr(h, path);
+    hashBytes(h, id, sizeof(id));
+    return 0;
+}
+
+// the file execvp would run for cmd
+static int findProgram(const char* cmd, char* path, size_t size) {
+    const char* dirs = varGet("PATH");
+    const char* end;
+
+    if (strchr(cmd, '/') != NULL) {
+        snprintf(path, size, "%s", cmd);
+        return 0;
+    }
+    for (; dirs != NULL && *dirs != '\0'; dirs = *end ? end + 1 : end) {
+        end = strchrnul(dirs, ':');
+        snprintf(path, size, "%.*s/%s", (int)(end - dirs), end > dirs ? dirs : ".", cmd);
+        if (access(path, X_OK) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int memoKey(job_info* job, char key[MEMO_KEY_LEN + 1]) {
+    proc_info* proc = job->procs;
+    hash128_t h = FNV128_OFFSET;
+    char path[PATH_MAX];
+    char* names;
+    char* name;
+    char* save;
+    int i;
+
+    if (getcwd(path, sizeof(path)) == NULL) {
+        return -1;
+    }
+    hashStr(&h, path);
+    for (i = 0; i < proc->argc; i++) {
+        hashStr(&h, proc->argv[i]);
+    }
+
+    // a new build of the program, or changed input, is a different run
+    if (findProgram(proc->cmd, path, sizeof(path)) == 0) {
+        hashFile(&h, path);
+    }
+    if (job->in_file != NULL && hashFile(&h, job->in_file) == -1) {
+        return -1;  // let the run report the bad redirection
+    }
+    for (i = 1; i < proc->argc; i++) {
+        hashFile(&h, proc->argv[i]);
+    }
+
+    names = strdup(varGet("MEMO_ENV") != NULL ? varGet("MEMO_ENV") : MEMO_ENV_DEFAULT);
+    for (name = strtok_r(names, " :", &save); name != NULL; name = strtok_r(NULL, " :", &save)) {
+        char* value = varGet(name);
+        hashStr(&h, name);
+        hashStr(&h, value != NULL ? value : "");
+        hashBytes(&h, value != NULL ? "=" : "!", 1);
+    }
+    free(names);
+
+    snprintf(key, MEMO_KEY_LEN + 1, "%016llx%016llx",
+             (unsigned long long)(h >> 64), (unsigned long long)h);
+    return 0;
+}
+
+// the store directory, created on first use; NULL without a usable home
+static char* memoDir() {
+    const char* base = varGet("XDG_CACHE_HOME");
+    const char* home = varGet("HOME");
+    char* dir;
+    char* p;
+
+    if (base != NULL && *base == '/') {
+        dir = malloc(strlen(base) + strlen(MEMO_DIR) + 2);
+        sprintf(dir, "%s/%s", base, MEMO_DIR);
+    } else if (home != NULL) {
+        dir = malloc(strlen(home) + strlen(MEMO_DIR) + 9);
+        sprintf(dir, "%s/.cache/%s", home, MEMO_DIR);
+    } else {
+        return NULL;
+    }
+    for (p = strchr(dir + 1, '/'); ; p = strchr(p + 1, '/')) {
+        if (p != NULL) {
+            *p = '\0';
+        }
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+            free(dir);
+            return NULL;
+        }
+        if (p == NULL) {
+            return dir;
+        }
+        *p = '/';
+    }
+}
+
+static int cmpUsed(const void* a, const void* b) {
+    const struct timespec* x = &((const memo_entry_t*)a)->used;
+    const struct timespec* y = &((const memo_entry_t*)b)->used;
+    if (x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+// every complete entry of the store; temporaries left by a crash are removed
+static memo_entry_t* scanStore(const char* dir, int* count, long long* total) {
+    DIR* d = opendir(dir);
+    struct dirent* de;
+    struct stat st;
+    memo_entry_t* entries = NULL;
+    int cap = 0;
+
+    *count = 0;
+    *total = 0;
+    if (d == NULL) {
+        return NULL;
+    }
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.' || fstatat(dirfd(d), de->d_name, &st, 0) == -1) {
+            continue;
+        }
+        if (strlen(de->d_name) != MEMO_KEY_LEN) {
+            if (st.st_mtime < time(NULL) - 3600) {
+                unlinkat(dirfd(d), de->d_name, 0);
+            }
+            continue;
+        }
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 64;
+            entries = realloc(entries, cap * sizeof(memo_entry_t));
+        }
+        strcpy(entries[*count].name, de->d_name);
+        entries[*count].size = st.st_size;
+        entries[*count].used = st.st_mtim;
+        *total += st.st_size;
+        (*count)++;
+    }
+    closedir(d);
+    return entries;
+}
+
+// remove the entries used longest ago until the store fits in limit
+static void memoEvict(const char* dir, long long limit) {
+    long long total;
+    int count, i;
+    memo_entry_t* entries = scanStore(dir, &count, &total);
+    char* path = malloc(strlen(dir) + MEMO_KEY_LEN + 2);
+
+    if (total > limit) {
+        qsort(entries, count, sizeof(memo_entry_t), cmpUsed);
+        for (i = 0; i < count && total > limit; i++) {
+            sprintf(path, "%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    free(path);
+    free(entries);
+}
+
+// write a stored run to dst; -1 if there is no (valid) entry at path
+static int replayEntry(const char* path, int dst[3], int* status, unsigned long long* runNs) {
+    memo_header_t hdr;
+    memo_chunk_t chunk;
+    char buf[MEMO_BUF];
+    ssize_t n;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return -1;
+    }
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, MEMO_MAGIC, sizeof(hdr.magic)) != 0) {
+        close(fd);
+        return -1;
+    }
+    futimens(fd, NULL);     // recently used: evicted last
+    fflush(stdout);
+    fflush(stderr);
+    while (read(fd, &chunk, sizeof(chunk)) == sizeof(chunk) &&
+           (chunk.fd == STDOUT_FILENO || chunk.fd == STDERR_FILENO)) {
+        while (chunk.len > 0 && (n = read(fd, buf, chunk.len < sizeof(buf) ? chunk.len : sizeof(buf))) > 0) {
+            writeAll(dst[chunk.fd], buf, n);
+            chunk.len -= n;
+        }
+    }
+    close(fd);
+    *status = hdr.status;
+    *runNs = hdr.runNs;
+    return 0;
+}
+
+static void giveUp(memo_run_t* run) {
+    if (run->store != -1) {
+        close(run->store);
+        unlink(run->tmp);
+        run->store = -1;
+    }
+}
+
+// pass output on to where it is going and into the entry
+static void teeReady(int fd, unsigned int events, void* arg) {
+    memo_stream_t* s = (memo_stream_t*)arg;
+    memo_run_t* run = s->run;
+    char buf[MEMO_BUF];
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EINTR) {
+        return;
+    }
+    if (n <= 0) {
+        eventRemove(fd);
+        close(fd);
+        run->open--;
+        return;
+    }
+    writeAll(s->dst, buf, n);
+    *s->bytes += n;
+
+    if (run->store != -1) {
+        memo_chunk_t chunk = {s->fd, (uint32_t)n};
+        run->stored += sizeof(chunk) + n;
+        // one huge output should not flush everything else out of the store
+        if (run->stored > (uint64_t)memoMax / 4 || writeAll(run->store, &chunk, sizeof(chunk)) == -1 ||
+            writeAll(run->store, buf, n) == -1) {
+            giveUp(run);
+        }
+    }
+}
+
+// run the command with its output piped through the shell; path NULL: do not store
+static int runAndStore(job_info* job, char* line, job_opts_t* opts, const char* path, int dst[3]) {
+    memo_run_t run;
+    memo_stream_t streams[2];
+    unsigned long long start = now();
+    int out[2], err[2];
+    int status;
+    pid_t pid;
+
+    memset(&run, 0, sizeof(run));
+    memcpy(run.hdr.magic, MEMO_MAGIC, sizeof(run.hdr.magic));
+    run.store = -1;
+    if (path != NULL) {
+        run.tmp = malloc(strlen(path) + 8);
+        sprintf(run.tmp, "%s.XXXXXX", path);
+        run.store = mkostemp(run.tmp, O_CLOEXEC);
+        if (run.store != -1 && writeAll(run.store, &run.hdr, sizeof(run.hdr)) == -1) {
+            giveUp(&run);
+        }
+    }
+
+    if (pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    char** envp = varsEnviron();
+    uint64_t spawnStart = metricsNow();
+    if ((pid = fork()) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        // the shell's stdin is not in the key, so the run must not see it
+        if (job->in_file == NULL) {
+            int null = open("/dev/null", O_RDONLY);
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
+        // the shell has opened the redirections and copies the output there
+        job->out_file = NULL;
+        job->procs->err_file = NULL;
+        execJob(job, line, opts, NULL, envp);
+    }
+    close(out[1]);
+    close(err[1]);
+    TRACE(TRACE_SPAWN, pid, 0);
+    metricsSpawned(spawnStart);
+    if (opts->timeout > 0) {
+        timerArm(pid, timerDeadline(opts->timeout), opts->timeout);
+    }
+
+    streams[0] = (memo_stream_t){STDOUT_FILENO, dst[STDOUT_FILENO], &run.hdr.outBytes, &run};
+    streams[1] = (memo_stream_t){STDERR_FILENO, dst[STDERR_FILENO], &run.hdr.errBytes, &run};
+    eventAdd(out[0], EPOLLIN, teeReady, &streams[0]);
+    eventAdd(err[0], EPOLLIN, teeReady, &streams[1]);
+    run.open = 2;
+    while (run.open > 0) {
+        if (eventPoll(-1) < 0) {
+            break;
+        }
+    }
+
+    if (waitForeground(pid, &status) < 0) {
+        printf(WAIT_ERR);
+        exit(EXIT_FAILURE);
+    }
+    TRACE(TRACE_EXIT, pid, status);
+    if (timerCancel(pid) > 0) {
+        printf(TIMEOUT_MSG, pid, opts->timeout);
+        status = TIMEOUT_STATUS << 8;
+        giveUp(&run);
+    } else if (!WIFEXITED(status)) {
+        giveUp(&run);
+    }
+
+    if (run.store != -1) {
+        run.hdr.status = status;
+        run.hdr.runNs = now() - start;
+        if (pwrite(run.store, &run.hdr, sizeof(run.hdr), 0) != sizeof(run.hdr) || rename(run.tmp, path) == -1) {
+            giveUp(&run);
+        } else {
+            close(run.store);
+        }
+    }
+    free(run.tmp);
+    return status;
+}
+
+int memoRun(job_info* job, char* line, job_opts_t* opts) {
+    char key[MEMO_KEY_LEN + 1];
+    char* dir = memoDir();
+    char* path = NULL;
+    int dst[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    unsigned long long runNs;
+    int status;
+
+    if (redirectionCheck(job) == -1) {
+        TRACE(TRACE_RD_ERR, getpid(), 0);
+        fprintf(stderr, RD_ERR);
+        free(dir);
+        return EXIT_FAILURE << 8;
+    }
+    if (job->out_file != NULL) {
+        dst[STDOUT_FILENO] = open(job->out_file, O_CREAT | O_WRONLY | O_CLOEXEC, 0777);
+    }
+    if (job->procs->err_file != NULL) {
+        dst[STDERR_FILENO] = open(job->procs->err_file, O_CREAT | O_WRONLY | O_CLOEXEC, 0777);
+    }
+
+    if (dir != NULL && memoKey(job, key) == 0) {
+        path = malloc(strlen(dir) + MEMO_KEY_LEN + 2);
+        sprintf(path, "%s/%s", dir, key);
+    }
+    if (path != NULL && replayEntry(path, dst, &status, &runNs) == 0) {
+        TRACE(TRACE_MEMO_HIT, getpid(), status);
+        hits++;
+        savedNs += runNs;
+    } else {
+        misses++;
+        status = runAndStore(job, line, opts, path, dst);
+        if (path != NULL) {
+            memoEvict(dir, memoMax);
+        }
+    }
+
+    if (dst[STDOUT_FILENO] > STDERR_FILENO) {
+        close(dst[STDOUT_FILENO]);
+    }
+    if (dst[STDERR_FILENO] > STDERR_FILENO) {
+        close(dst[STDERR_FILENO]);
+    }
+    free(path);
+    free(dir);
+    return status;
+}
+
+void memoCommand(job_info* job) {
+    proc_info* proc = job->procs;
+    char* dir = memoDir();
+    long long total;
+    int count;
+
+    if (dir == NULL) {
+        fprintf(stderr, MEMO_ERR);
+        return;
+    }
+    if (proc->argc > 2 && strcmp(proc->argv[1], "-m") == 0 && atoll(proc->argv[2]) > 0) {
+        memoMax = atoll(proc->argv[2]);
+        memoEvict(dir, memoMax);
+    } else if (proc->argc > 1 && strcmp(proc->argv[1], "-c") == 0) {
+        memoEvict(dir, 0);
+    }
+
+    free(scanStore(dir, &count, &total));
+    printf("memo: %lu hits, %lu misses, %.3fs saved\n", hits, misses, savedNs / 1e9);
+    printf("memo store: %s, %d entries, %lld of %lld bytes\n", dir, count, total, memoMax);
+    free(dir);
+}
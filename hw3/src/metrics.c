@@ -0,0 +1,113 @@
+#include "metrics.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+metrics_page_t* metrics = NULL;     // NULL while metrics are off
+
+static volatile uint64_t sigchldNs = 0;     // oldest SIGCHLD not yet followed by a reap
+
+static uint64_t monotonicNs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int i = 0;
+
+    while (us > 1 && i < METRICS_BUCKETS - 1) {
+        us >>= 1;
+        i++;
+    }
+    return i;
+}
+
+int metricsOpen(const char* path) {
+    struct timespec ts;
+    metrics_page_t* page;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(metrics_page_t)) == -1) {
+        close(fd);
+        return -1;
+    }
+    page = mmap(NULL, sizeof(metrics_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        return -1;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memcpy(page->magic, METRICS_MAGIC, sizeof(page->magic));
+    page->pid = getpid();
+    page->startNs = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    __atomic_store_n(&page->version, METRICS_VERSION, __ATOMIC_RELEASE);
+    metrics = page;
+    return 0;
+}
+
+void metricsClose() {
+    if (metrics != NULL) {
+        munmap(metrics, sizeof(metrics_page_t));
+        metrics = NULL;
+    }
+}
+
+uint64_t metricsNow() {
+    return metrics != NULL ? monotonicNs() : 0;
+}
+
+void metricsSpawned(uint64_t start) {
+    if (metrics != NULL && start != 0) {
+        uint64_t ns = monotonicNs() - start;
+        METRIC_ADD(spawned, 1);
+        METRIC_ADD(spawnNs, ns);
+        METRIC_ADD(spawnHist[bucket(ns)], 1);
+    }
+}
+
+void metricsParsed(uint64_t start) {
+    if (metrics != NULL && start != 0) {
+        uint64_t ns = monotonicNs() - start;
+        METRIC_ADD(lines, 1);
+        METRIC_ADD(parseNs, ns);
+        METRIC_ADD(parseHist[bucket(ns)], 1);
+    }
+}
+
+void metricsExecFailed() {
+    if (metrics != NULL) {
+        __atomic_fetch_add(&metrics->execFailures, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void metricsSigchld() {
+    if (metrics != NULL && sigchldNs == 0) {
+        sigchldNs = monotonicNs();
+    }
+}
+
+void metricsReaped() {
+    if (metrics == NULL) {
+        return;
+    }
+    METRIC_ADD(reaped, 1);
+    if (sigchldNs != 0) {
+        uint64_t lag = monotonicNs() - sigchldNs;
+        METRIC_ADD(reapLagNs, lag);
+        if (lag > metrics->reapLagMaxNs) {
+            METRIC_SET(reapLagMaxNs, lag);
+        }
+    }
+}
+
+void metricsReapDone() {
+    sigchldNs = 0;
+}
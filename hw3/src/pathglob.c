@@ -0,0 +1,516 @@
+#include "pathglob.h"
+#include "arena.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define GLOB_BUCKETS 1024
+
+/*
+ * Cached listing of one directory. All names share one buffer; offs[i] is
+ * where the i-th NUL-terminated name starts and types[i] its d_type.
+ */
+typedef struct dirlist {
+    char* path;
+    struct timespec mtime;
+    ino_t ino;
+    dev_t dev;
+    unsigned long gen;          // line the listing was last validated on
+    char* names;
+    unsigned int* offs;
+    unsigned char* types;
+    int count;
+    struct dirlist* next;       // hash chain
+} dirlist_t;
+
+/*
+ * Matches of one word, built in a single growable buffer and sorted by
+ * offset so no string is allocated per match.
+ */
+typedef struct results {
+    char* buf;
+    size_t len;
+    size_t size;
+    size_t* offs;
+    int count;
+    int cap;
+} results_t;
+
+// layout of the records returned by getdents64; fixed width whatever ino_t and off_t are
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+int globCacheLines = 0;
+
+static dirlist_t* buckets[GLOB_BUCKETS];
+static int ncached = 0;
+static unsigned long generation = 1;
+static char* dentsBuf = NULL;
+
+static unsigned int hashPath(const char* s) {
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
+}
+
+static void freeListing(dirlist_t* d) {
+    free(d->path);
+    free(d->names);
+    free(d->offs);
+    free(d->types);
+    free(d);
+}
+
+static void flushCache() {
+    int i;
+    for (i = 0; i < GLOB_BUCKETS; i++) {
+        while (buckets[i] != NULL) {
+            dirlist_t* next = buckets[i]->next;
+            freeListing(buckets[i]);
+            buckets[i] = next;
+        }
+    }
+    ncached = 0;
+}
+
+// read a whole directory in GLOB_DENTS_BUF batches; NULL if it cannot be opened
+static dirlist_t* readListing(const char* path, struct stat* st) {
+    size_t namesLen = 0, namesSize = 4096;
+    int cap = 64;
+    long n;
+    int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return NULL;
+    }
+    if (dentsBuf == NULL) {
+        dentsBuf = malloc(GLOB_DENTS_BUF);
+    }
+
+    dirlist_t* d = calloc(1, sizeof(dirlist_t));
+    d->path = strdup(path);
+    d->mtime = st->st_mtim;
+    d->ino = st->st_ino;
+    d->dev = st->st_dev;
+    d->names = malloc(namesSize);
+    d->offs = malloc(cap * sizeof(unsigned int));
+    d->types = malloc(cap);
+
+    while ((n = syscall(SYS_getdents64, fd, dentsBuf, GLOB_DENTS_BUF)) > 0) {
+        long pos = 0;
+        while (pos < n) {
+            struct linux_dirent64* de = (struct linux_dirent64*)(dentsBuf + pos);
+            size_t len = strlen(de->d_name);
+            pos += de->d_reclen;
+            if (de->d_name[0] == '.' && (len == 1 || (len == 2 && de->d_name[1] == '.'))) {
+                continue;
+            }
+            if (d->count == cap) {
+                cap *= 2;
+                d->offs = realloc(d->offs, cap * sizeof(unsigned int));
+                d->types = realloc(d->types, cap);
+            }
+            if (namesLen + len + 1 > namesSize) {
+                while (namesLen + len + 1 > namesSize) {
+                    namesSize *= 2;
+                }
+                d->names = realloc(d->names, namesSize);
+            }
+            memcpy(d->names + namesLen, de->d_name, len + 1);
+            d->offs[d->count] = namesLen;
+            d->types[d->count] = de->d_type;
+            d->count++;
+            namesLen += len + 1;
+        }
+    }
+    close(fd);
+    return d;
+}
+
+// cached listing of path ("" is the current directory)
+static dirlist_t* getListing(const char* path) {
+    struct stat st;
+    unsigned int b = hashPath(path) % GLOB_BUCKETS;
+    dirlist_t** link = &buckets[b];
+
+    for (; *link != NULL; link = &(*link)->next) {
+        dirlist_t* d = *link;
+        if (strcmp(d->path, path) != 0) {
+            continue;
+        }
+        if (d->gen == generation) {
+            return d;
+        }
+        // from an earlier line: still good if the directory did not change
+        if (stat(*path ? path : ".", &st) == 0 && st.st_ino == d->ino && st.st_dev == d->dev &&
+            st.st_mtim.tv_sec == d->mtime.tv_sec && st.st_mtim.tv_nsec == d->mtime.tv_nsec) {
+            d->gen = generation;
+            return d;
+        }
+        *link = d->next;
+        freeListing(d);
+        ncached--;
+        break;
+    }
+
+    if (stat(*path ? path : ".", &st) == -1 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    if (ncached >= GLOB_CACHE_MAX) {
+        flushCache();
+    }
+    dirlist_t* d = readListing(path, &st);
+    if (d == NULL) {
+        return NULL;
+    }
+    d->gen = generation;
+    d->next = buckets[b];
+    buckets[b] = d;
+    ncached++;
+    return d;
+}
+
+static int hasMeta(const char* s) {
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) {
+            s++;
+        } else if (*s == '*' || *s == '?' || *s == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// match c against the bracket expression at p ("[...]"); sets *end past ']'
+// returns -1 if the expression is not terminated (then '[' is literal)
+static int matchClass(const char* p, char c, const char** end) {
+    int negate = 0, found = 0;
+
+    p++;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    const char* first = p;
+    while (*p && (*p != ']' || p == first)) {
+        char lo = *p, hi;
+        if (lo == '\\' && p[1]) {
+            lo = *++p;
+        }
+        hi = lo;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            hi = p[2];
+            p += 2;
+        }
+        if (c >= lo && c <= hi) {
+            found = 1;
+        }
+        p++;
+    }
+    if (*p != ']') {
+        return -1;
+    }
+    *end = p + 1;
+    return found != negate;
+}
+
+static int globMatch(const char* p, const char* s) {
+    const char* star = NULL;
+    const char* resume = NULL;
+    const char* end;
+    int m;
+
+    // wildcards never match a leading '.'
+    if (*s == '.' && *p != '.') {
+        return 0;
+    }
+    while (*s) {
+        if (*p == '*') {
+            star = ++p;
+            resume = s;
+            continue;
+        }
+        if (*p == '?') {
+            p++;
+            s++;
+            continue;
+        }
+        if (*p == '[' && (m = matchClass(p, *s, &end)) != -1) {
+            if (m) {
+                p = end;
+                s++;
+                continue;
+            }
+        } else {
+            char lit = *p;
+            if (lit == '\\' && p[1]) {
+                lit = *++p;
+            }
+            if (lit != '\0' && lit == *s) {
+                p++;
+                s++;
+                continue;
+            }
+        }
+        if (star == NULL) {
+            return 0;
+        }
+        p = star;
+        s = ++resume;
+    }
+    while (*p == '*') {
+        p++;
+    }
+    return *p == '\0';
+}
+
+static void addResult(results_t* r, const char* path, size_t len) {
+    if (r->len + len + 1 > r->size) {
+        r->size = r->size ? r->size * 2 : 4096;
+        while (r->len + len + 1 > r->size) {
+            r->size *= 2;
+        }
+        r->buf = realloc(r->buf, r->size);
+    }
+    if (r->count == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 64;
+        r->offs = realloc(r->offs, r->cap * sizeof(size_t));
+    }
+    memcpy(r->buf + r->len, path, len);
+    r->buf[r->len + len] = '\0';
+    r->offs[r->count++] = r->len;
+    r->len += len + 1;
+}
+
+// is entry i of d a directory? symlinks are followed unless noFollow
+static int isDir(dirlist_t* d, int i, char* path, size_t len, int noFollow) {
+    struct stat st;
+    unsigned char t = d->types[i];
+
+    if (t == DT_DIR) {
+        return 1;
+    }
+    if (t != DT_UNKNOWN && (t != DT_LNK || noFollow)) {
+        return 0;
+    }
+    memcpy(path + len, d->names + d->offs[i], strlen(d->names + d->offs[i]) + 1);
+    int rc = noFollow ? lstat(path, &st) : stat(path, &st);
+    path[len] = '\0';
+    return rc == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Match comps[0..ncomps) below the directory named by path[0..len). path
+ * is a PATH_MAX buffer that is extended in place while descending.
+ */
+static void expandFrom(char* path, size_t len, char** comps, int ncomps, results_t* r) {
+    struct stat st;
+    int i;
+
+    if (ncomps == 0) {
+        addResult(r, path, len);
+        return;
+    }
+    char* comp = comps[0];
+    size_t clen = strlen(comp);
+
+    // literal component: no directory read needed on the way down
+    if (!hasMeta(comp)) {
+        if (len + clen + 2 >= PATH_MAX) {
+            return;
+        }
+        for (i = 0; comp[i]; i++) {   // drop escapes
+            if (comp[i] == '\\' && comp[i + 1]) {
+                i++;
+            }
+            path[len++] = comp[i];
+        }
+        path[len] = '\0';
+        if (ncomps == 1) {
+            if (lstat(*path ? path : ".", &st) == 0) {
+                addResult(r, path, len);
+            }
+            return;
+        }
+        path[len++] = '/';
+        path[len] = '\0';
+        expandFrom(path, len, comps + 1, ncomps - 1, r);
+        return;
+    }
+
+    dirlist_t* d = getListing(path);
+    if (d == NULL) {
+        return;
+    }
+
+    // ** matches zero or more directories, or everything below when it comes
+    // last; it never enters hidden directories or follows symlinks
+    if (strcmp(comp, "**") == 0) {
+        int last = ncomps == 1;
+        if (!last) {
+            expandFrom(path, len, comps + 1, ncomps - 1, r);
+        }
+        for (i = 0; i < d->count; i++) {
+            char* name = d->names + d->offs[i];
+            size_t nlen = strlen(name);
+            if (name[0] == '.' || len + nlen + 2 >= PATH_MAX) {
+                continue;
+            }
+            if (last) {
+                memcpy(path + len, name, nlen + 1);
+                addResult(r, path, len + nlen);
+                path[len] = '\0';
+            }
+            if (!isDir(d, i, path, len, 1)) {
+                continue;
+            }
+            memcpy(path + len, name, nlen);
+            path[len + nlen] = '/';
+            path[len + nlen + 1] = '\0';
+            expandFrom(path, len + nlen + 1, comps, ncomps, r);
+            // the recursion may have flushed the cache; look d up again
+            path[len] = '\0';
+            if ((d = getListing(path)) == NULL) {
+                return;
+            }
+        }
+        return;
+    }
+
+    for (i = 0; i < d->count; i++) {
+        char* name = d->names + d->offs[i];
+        size_t nlen = strlen(name);
+        if (!globMatch(comp, name) || len + nlen + 2 >= PATH_MAX) {
+            continue;
+        }
+        if (ncomps == 1) {
+            memcpy(path + len, name, nlen + 1);
+            addResult(r, path, len + nlen);
+        } else if (isDir(d, i, path, len, 0)) {
+            memcpy(path + len, name, nlen);
+            path[len + nlen] = '/';
+            path[len + nlen + 1] = '\0';
+            expandFrom(path, len + nlen + 1, comps + 1, ncomps - 1, r);
+            path[len] = '\0';
+            if ((d = getListing(path)) == NULL) {
+                return;
+            }
+        }
+    }
+    path[len] = '\0';
+}
+
+static results_t* sortBuf;
+
+static int compareResults(const void* a, const void* b) {
+    return strcmp(sortBuf->buf + *(const size_t*)a, sortBuf->buf + *(const size_t*)b);
+}
+
+int globWord(const char* pattern, char*** matches) {
+    char path[PATH_MAX];
+    char* comps[PATH_MAX / 2];
+    int ncomps = 0, i;
+    results_t r;
+    size_t len = 0;
+
+    memset(&r, 0, sizeof(r));
+    char* copy = arenaStrndup(pattern, strlen(pattern));
+    if (copy == NULL) {
+        return 0;
+    }
+    if (*copy == '/') {
+        path[len++] = '/';
+    }
+    path[len] = '\0';
+
+    // split into components; repeated slashes collapse
+    char* save = NULL;
+    for (char* c = strtok_r(copy, "/", &save); c != NULL; c = strtok_r(NULL, "/", &save)) {
+        comps[ncomps++] = c;
+    }
+    // a trailing slash only matches directories
+    if (ncomps > 0 && pattern[strlen(pattern) - 1] == '/') {
+        comps[ncomps++] = "";
+    }
+    expandFrom(path, len, comps, ncomps, &r);
+
+    if (r.count > 0) {
+        sortBuf = &r;
+        qsort(r.offs, r.count, sizeof(size_t), compareResults);
+        // hand the matches out of the arena so they live until the next line
+        char* strings = arenaAlloc(r.len);
+        *matches = arenaAlloc(r.count * sizeof(char*));
+        memcpy(strings, r.buf, r.len);
+        for (i = 0; i < r.count; i++) {
+            (*matches)[i] = strings + r.offs[i];
+        }
+    }
+    free(r.buf);
+    free(r.offs);
+    return r.count;
+}
+
+int expandJob(job_info* job) {
+    proc_info* proc;
+    int expanded = 0;
+    int i, j;
+
+    for (proc = job->procs; proc != NULL; proc = proc->next_proc) {
+        char*** found = NULL;
+        int* counts = NULL;
+        int total = 0;
+
+        for (i = 0; i < proc->argc; i++) {
+            if (!hasMeta(proc->argv[i])) {
+                total++;
+                continue;
+            }
+            if (found == NULL) {
+                found = calloc(proc->argc, sizeof(char**));
+                counts = calloc(proc->argc, sizeof(int));
+            }
+            counts[i] = globWord(proc->argv[i], &found[i]);
+            total += counts[i] > 0 ? counts[i] : 1;
+            expanded += counts[i] > 0;
+        }
+        if (found == NULL) {    // nothing to expand: argv stays as parsed
+            continue;
+        }
+
+        char** argv = malloc((total + 1) * sizeof(char*));
+        int n = 0;
+        for (i = 0; i < proc->argc; i++) {
+            if (counts[i] == 0) {
+                argv[n++] = proc->argv[i];
+            }
+            for (j = 0; j < counts[i]; j++) {
+                argv[n++] = found[i][j];
+            }
+        }
+        argv[n] = NULL;
+        free(proc->argv);
+        proc->argv = argv;
+        proc->argc = n;
+        proc->cmd = argv[0];
+        free(found);
+        free(counts);
+    }
+    return expanded;
+}
+
+void globReset() {
+    generation++;
+    if (!globCacheLines) {
+        flushCache();
+    }
+    arenaReset();
+}
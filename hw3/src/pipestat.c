@@ -0,0 +1,234 @@
+#include "pipestat.h"
+#include "events.h"
+#include "metrics.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+#define NSEC 1000000000ULL
+
+enum { LINK_FLOWING, LINK_EMPTY, LINK_FULL, LINK_DONE };
+
+int pipeSize = 0;
+int pipeStatEnabled = 0;
+
+static unsigned long long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+int pipeResize(int fd, int size) {
+    if (size <= 0) {
+        return 0;
+    }
+    return fcntl(fd, F_SETPIPE_SZ, size);
+}
+
+int setPipeSize(int size) {
+    int fd[2];
+    int actual;
+
+    if (size == 0) {
+        pipeSize = 0;
+        return 0;
+    }
+    if (size < 0 || pipe(fd) == -1) {
+        return -1;
+    }
+    // above /proc/sys/fs/pipe-max-size only root may go
+    actual = pipeResize(fd[1], size);
+    close(fd[0]);
+    close(fd[1]);
+    if (actual == -1) {
+        return -1;
+    }
+    pipeSize = actual;
+    return 0;
+}
+
+pipestat_t* pipestatOpen(job_info* job) {
+    pipestat_t* stats = calloc(1, sizeof(pipestat_t) + (job->nproc - 1) * sizeof(pipelink_t));
+    proc_info* proc;
+    int i;
+
+    // argv belongs to the parser, which reuses it for the next line
+    stats->names = malloc(job->nproc * sizeof(char*));
+    for (i = 0, proc = job->procs; proc != NULL; i++, proc = proc->next_proc) {
+        stats->names[i] = strdup(proc->cmd);
+    }
+    stats->nlinks = job->nproc - 1;
+    for (i = 0; i < stats->nlinks; i++) {
+        stats->links[i].in = stats->links[i].out = -1;
+        stats->links[i].state = LINK_DONE;
+    }
+    return stats;
+}
+
+static void enterState(pipelink_t* link, int state) {
+    unsigned long long t = now();
+
+    if (link->state == LINK_EMPTY) {
+        link->emptyNs += t - link->since;
+    } else if (link->state == LINK_FULL) {
+        link->fullNs += t - link->since;
+    }
+    link->state = state;
+    link->since = t;
+}
+
+static void closeLink(pipelink_t* link) {
+    enterState(link, LINK_DONE);
+    link->end = link->since;
+    eventRemove(link->in);
+    eventRemove(link->out);
+    close(link->in);
+    close(link->out);
+    link->in = link->out = -1;
+}
+
+static void relayReady(int fd, unsigned int events, void* arg);
+
+// splice until one side would block, then wait on that side
+static void relay(pipelink_t* link) {
+    sigset_t pipeMask, prev;
+    struct timespec zero = {0, 0};
+    ssize_t n;
+    int avail = 0;
+
+    // a stage that has gone away must not take the shell down with SIGPIPE
+    sigemptyset(&pipeMask);
+    sigaddset(&pipeMask, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipeMask, &prev);
+    while ((n = splice(link->in, NULL, link->out, NULL, RELAY_CHUNK,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) {
+            link->bytes += n;
+            METRIC_ADD(pipeBytes, n);
+        }
+    }
+    if (n < 0 && errno == EPIPE) {
+        sigtimedwait(&pipeMask, NULL, &zero);
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    if (n == 0 || errno != EAGAIN) {    // upstream done, or downstream gone
+        closeLink(link);
+        return;
+    }
+
+    // would block: on the reading side if the upstream pipe is empty
+    ioctl(link->in, FIONREAD, &avail);
+    if (avail > 0 && link->state != LINK_FULL) {
+        enterState(link, LINK_FULL);
+        eventRemove(link->in);
+        eventAdd(link->out, EPOLLOUT, relayReady, link);
+    } else if (avail == 0 && link->state != LINK_EMPTY) {
+        enterState(link, LINK_EMPTY);
+        eventRemove(link->out);
+        eventAdd(link->in, EPOLLIN, relayReady, link);
+    }
+}
+
+static void relayReady(int fd, unsigned int events, void* arg) {
+    relay((pipelink_t*)arg);
+}
+
+int pipestatLink(pipestat_t* stats, int k, int fd[2], int size) {
+    pipelink_t* link = &stats->links[k];
+    int up[2], down[2];
+
+    // the shell's ends are close-on-exec so no stage holds a link open
+    if (pipe2(up, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    if (pipe2(down, O_CLOEXEC) == -1) {
+        close(up[0]);
+        close(up[1]);
+        return -1;
+    }
+    pipeResize(up[1], size);
+    pipeResize(down[1], size);
+
+    link->in = up[0];
+    link->out = down[1];
+    link->start = link->since = now();
+    link->state = LINK_FLOWING;
+    fd[0] = down[0];
+    fd[1] = up[1];
+    relay(link);
+    return 0;
+}
+
+void pipestatFinish(pipestat_t* stats) {
+    int i;
+
+    if (stats == NULL) {
+        return;
+    }
+    for (i = 0; i < stats->nlinks; i++) {
+        if (stats->links[i].state != LINK_DONE) {
+            relay(&stats->links[i]);
+        }
+        // still open: something outside the job holds a pipe
+        if (stats->links[i].state != LINK_DONE) {
+            closeLink(&stats->links[i]);
+        }
+    }
+}
+
+void pipestatReport(pipestat_t* stats, FILE* out) {
+    unsigned long long t = now();
+    double worst = 0.001;   // below a millisecond nobody held anything up
+    int slowest = -1;
+    int i;
+
+    if (stats == NULL) {
+        return;
+    }
+    for (i = 0; i < stats->nlinks; i++) {
+        pipelink_t* link = &stats->links[i];
+        unsigned long long end = link->end ? link->end : t;
+        unsigned long long waiting = link->state == LINK_DONE ? 0 : t - link->since;
+        double empty = (link->emptyNs + (link->state == LINK_EMPTY ? waiting : 0)) / (double)NSEC;
+        double full = (link->fullNs + (link->state == LINK_FULL ? waiting : 0)) / (double)NSEC;
+        double secs = (end - link->start) / (double)NSEC;
+
+        fprintf(out, "\tpipe %d (%s) -> %d (%s): %llu bytes, %.1f MB/s, empty %.2fs, full %.2fs\n",
+                i + 1, stats->names[i], i + 2, stats->names[i + 1], link->bytes,
+                secs > 0 ? link->bytes / secs / 1e6 : 0.0, empty, full);
+
+        // a slow stage leaves its output pipe empty and its input pipe full
+        if (empty > worst) {
+            worst = empty;
+            slowest = i;
+        }
+        if (full > worst) {
+            worst = full;
+            slowest = i + 1;
+        }
+    }
+    if (slowest != -1) {
+        fprintf(out, "\tslowest stage: %d (%s)\n", slowest + 1, stats->names[slowest]);
+    }
+}
+
+void pipestatFree(pipestat_t* stats) {
+    int i;
+
+    if (stats == NULL) {
+        return;
+    }
+    for (i = 0; i < stats->nlinks; i++) {
+        if (stats->links[i].state != LINK_DONE) {
+            closeLink(&stats->links[i]);
+        }
+    }
+    for (i = 0; i <= stats->nlinks; i++) {
+        free(stats->names[i]);
+    }
+    free(stats->names);
+    free(stats);
+}
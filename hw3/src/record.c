@@ -0,0 +1,133 @@
+#include "record.h"
+#include "events.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <readline/readline.h>
+
+static FILE* recOut = NULL;
+static FILE* replayIn = NULL;
+static int replayPaced = 0;
+static unsigned long long startNs = 0;
+static int lineOpen = 0;        // a line was recorded and is not done yet
+static uint64_t traceNext = 0;  // next trace event to record
+
+static char* replayBuf = NULL;
+static size_t replayCap = 0;
+
+static unsigned long long nowNs() {
+    struct timespec ts;
+    // the same clock as the trace events
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sessionStart() {
+    if (startNs == 0) {
+        startNs = nowNs();
+    }
+}
+
+int recordOpen(const char* path) {
+    if ((recOut = fopen(path, "we")) == NULL || traceStart() == -1) {
+        return -1;
+    }
+    sessionStart();
+    traceNext = __atomic_load_n(&traceRing->head, __ATOMIC_ACQUIRE);
+    fprintf(recOut, "# 53shell record %d\n", RECORD_VERSION);
+    return 0;
+}
+
+int replayOpen(const char* path, int paced) {
+    if ((replayIn = fopen(path, "re")) == NULL) {
+        return -1;
+    }
+    sessionStart();
+    replayPaced = paced;
+    return 0;
+}
+
+int replayActive() {
+    return replayIn != NULL;
+}
+
+// copy the trace events that arrived since the last call into the recording
+static void recordEvents() {
+    uint64_t head;
+
+    if (traceRing == NULL) {    // tracing was turned off by hand
+        return;
+    }
+    head = __atomic_load_n(&traceRing->head, __ATOMIC_ACQUIRE);
+    if (head - traceNext > TRACE_CAPACITY) {
+        traceNext = head - TRACE_CAPACITY;
+    }
+    for (; traceNext < head; traceNext++) {
+        trace_event_t* ev = &traceRing->events[traceNext & (TRACE_CAPACITY - 1)];
+        if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != (uint32_t)(traceNext + 1)) {
+            continue;   // overwritten or still being written
+        }
+        fprintf(recOut, "E %llu %s %d %d\n", (unsigned long long)ev->ns - startNs,
+                traceName(ev->type), ev->pid, ev->arg);
+    }
+}
+
+// the next L record of the replay, waiting for its time if paced
+static char* replayLine() {
+    unsigned long long at;
+    ssize_t len;
+    int off;
+
+    while ((len = getline(&replayBuf, &replayCap, replayIn)) > 0) {
+        if (replayBuf[len - 1] == '\n') {
+            replayBuf[len - 1] = '\0';
+        }
+        if (sscanf(replayBuf, "L %llu %n", &at, &off) != 1) {
+            continue;
+        }
+        // keep background jobs and timers serviced while waiting
+        while (replayPaced && nowNs() < startNs + at) {
+            eventPoll((startNs + at - nowNs()) / 1000000 + 1);
+        }
+        return strdup(replayBuf + off);
+    }
+    return NULL;
+}
+
+void recordLineDone(int status) {
+    if (recOut == NULL || !lineOpen) {
+        return;
+    }
+    recordEvents();
+    fprintf(recOut, "D %llu %d\n", nowNs() - startNs, status);
+    fflush(recOut);
+    lineOpen = 0;
+}
+
+char* recordNextLine(const char* prompt, int lastStatus) {
+    recordLineDone(lastStatus);
+
+    char* line = replayIn != NULL ? replayLine() : readline(prompt);
+
+    if (line != NULL && recOut != NULL) {
+        fprintf(recOut, "L %llu %s\n", nowNs() - startNs, line);
+        fflush(recOut);     // before any fork, or a failed exec's exit() writes it again
+        lineOpen = 1;
+    }
+    return line;
+}
+
+void recordClose() {
+    if (recOut != NULL) {
+        recordEvents();
+        fclose(recOut);
+        recOut = NULL;
+    }
+    if (replayIn != NULL) {
+        fclose(replayIn);
+        replayIn = NULL;
+    }
+    free(replayBuf);
+    replayBuf = NULL;
+}
@@ -0,0 +1,190 @@
+#include "timers.h"
+#include "events.h"
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSEC 1000000000ULL
+
+/*
+ * One watched process. Pending deadlines live in a min-heap ordered by
+ * when; every deadline (pending or already fired) is also on a list so it
+ * can be found by pid when the process is reaped.
+ */
+typedef struct deadline {
+    pid_t pid;
+    unsigned long long when;    // next action, CLOCK_MONOTONIC ns
+    int seconds;                // the limit, for reporting
+    int fired;                  // SIGTERM has been sent
+    int slot;                   // index in heap, -1 when not pending
+    struct deadline* next;
+} deadline_t;
+
+int bgTimeout = 0;
+
+static int tfd = -1;
+static deadline_t** heap = NULL;
+static int heapLen = 0;
+static int heapCap = 0;
+static deadline_t* all = NULL;
+
+static unsigned long long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+unsigned long long timerDeadline(int seconds) {
+    return now() + seconds * NSEC;
+}
+
+static void heapSet(int i, deadline_t* d) {
+    heap[i] = d;
+    d->slot = i;
+}
+
+static void siftUp(int i) {
+    deadline_t* d = heap[i];
+    while (i > 0 && heap[(i - 1) / 2]->when > d->when) {
+        heapSet(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heapSet(i, d);
+}
+
+static void siftDown(int i) {
+    deadline_t* d = heap[i];
+    while (2 * i + 1 < heapLen) {
+        int c = 2 * i + 1;
+        if (c + 1 < heapLen && heap[c + 1]->when < heap[c]->when) {
+            c++;
+        }
+        if (heap[c]->when >= d->when) {
+            break;
+        }
+        heapSet(i, heap[c]);
+        i = c;
+    }
+    heapSet(i, d);
+}
+
+static void heapPush(deadline_t* d) {
+    if (heapLen == heapCap) {
+        heapCap = heapCap ? heapCap * 2 : 16;
+        heap = realloc(heap, heapCap * sizeof(deadline_t*));
+    }
+    heapSet(heapLen++, d);
+    siftUp(d->slot);
+}
+
+static void heapRemove(deadline_t* d) {
+    int i = d->slot;
+    deadline_t* last = heap[--heapLen];
+
+    d->slot = -1;
+    if (i == heapLen) {
+        return;
+    }
+    heapSet(i, last);
+    siftDown(i);
+    siftUp(last->slot);
+}
+
+// point the timerfd at the earliest pending deadline, or disarm it
+static void rearm() {
+    struct itimerspec its = {{0, 0}, {0, 0}};
+
+    if (heapLen > 0) {
+        its.it_value.tv_sec = heap[0]->when / NSEC;
+        its.it_value.tv_nsec = heap[0]->when % NSEC;
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void timerExpired(int fd, unsigned int events, void* arg) {
+    uint64_t ticks;
+    unsigned long long t = now();
+
+    if (read(fd, &ticks, sizeof(ticks)) < 0) {
+        // spurious wakeup; the heap below is still authoritative
+    }
+    while (heapLen > 0 && heap[0]->when <= t) {
+        deadline_t* d = heap[0];
+        if (!d->fired) {
+            kill(d->pid, SIGTERM);
+            d->fired = 1;
+            d->when = t + TIMEOUT_GRACE * NSEC;
+            siftDown(0);
+        } else {
+            kill(d->pid, SIGKILL);
+            heapRemove(d);
+        }
+    }
+    rearm();
+}
+
+void timerArm(pid_t pid, unsigned long long deadline, int seconds) {
+    if (tfd == -1) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (tfd == -1 || eventAdd(tfd, EPOLLIN, timerExpired, NULL) == -1) {
+            return;
+        }
+    }
+
+    deadline_t* d = malloc(sizeof(deadline_t));
+    d->pid = pid;
+    d->when = deadline;
+    d->seconds = seconds;
+    d->fired = 0;
+    d->next = all;
+    all = d;
+    heapPush(d);
+    if (d->slot == 0) {
+        rearm();
+    }
+}
+
+int timerCancel(pid_t pid) {
+    deadline_t** link = &all;
+    int limit = 0;
+
+    while (*link != NULL && (*link)->pid != pid) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        return 0;
+    }
+
+    deadline_t* d = *link;
+    *link = d->next;
+    if (d->slot != -1) {
+        int wasFirst = d->slot == 0;
+        heapRemove(d);
+        if (wasFirst) {
+            rearm();
+        }
+    }
+    if (d->fired) {
+        limit = d->seconds;
+    }
+    free(d);
+    return limit;
+}
+
+void timerForget() {
+    deadline_t* d;
+
+    if (tfd != -1) {
+        close(tfd);
+        tfd = -1;
+    }
+    while ((d = all) != NULL) {
+        all = d->next;
+        free(d);
+    }
+    heapLen = 0;
+}
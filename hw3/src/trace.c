@@ -0,0 +1,134 @@
+#include "trace.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+trace_ring_t* traceRing = NULL;     // NULL while tracing is off
+
+static trace_ring_t* ring = NULL;   // stays mapped once created
+
+static const char* traceNames[] = {
+    [TRACE_PARSE] = "parse",
+    [TRACE_SPAWN] = "spawn",
+    [TRACE_EXEC] = "exec",
+    [TRACE_EXEC_ERR] = "exec_err",
+    [TRACE_RD_ERR] = "rd_err",
+    [TRACE_EXIT] = "exit",
+    [TRACE_BG_TERM] = "bg_term",
+    [TRACE_SIGCHLD] = "sigchld",
+    [TRACE_MEMO_HIT] = "memo_hit",
+};
+
+#define NTRACE_NAMES (sizeof(traceNames) / sizeof(traceNames[0]))
+
+void traceRecord(trace_type_t type, pid_t pid, int arg) {
+    struct timespec ts;
+    trace_ring_t* r = traceRing;
+
+    if (r == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t idx = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    trace_event_t* ev = &r->events[idx & (TRACE_CAPACITY - 1)];
+
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    ev->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    ev->type = type;
+    ev->pid = pid;
+    ev->arg = arg;
+    __atomic_store_n(&ev->seq, (uint32_t)(idx + 1), __ATOMIC_RELEASE);
+}
+
+int traceStart() {
+    if (ring == NULL) {
+        void* mem = mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return -1;
+        }
+        ring = (trace_ring_t*)mem;
+    }
+    traceRing = ring;
+    return 0;
+}
+
+void traceStop() {
+    traceRing = NULL;
+}
+
+const char* traceName(uint32_t type) {
+    return type < NTRACE_NAMES && traceNames[type] ? traceNames[type] : "unknown";
+}
+
+int traceFormat(const trace_event_t* ev, char* buf, size_t size) {
+    const char* name = traceName(ev->type);
+    return snprintf(buf, size, "{\"ts\":%llu,\"event\":\"%s\",\"pid\":%d,\"arg\":%d}\n",
+                    (unsigned long long)ev->ns, name, ev->pid, ev->arg);
+}
+
+static int writeAll(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int traceFlush(int fd, int binary) {
+    char buf[128];
+    trace_file_header_t hdr;
+    uint64_t head, from, i;
+    int count = 0;
+
+    if (ring == NULL) {
+        return 0;
+    }
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    from = ring->flushed;
+    // anything older than one ring's worth has been overwritten
+    if (head - from > TRACE_CAPACITY) {
+        from = head - TRACE_CAPACITY;
+    }
+
+    if (binary) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        hdr.version = TRACE_VERSION;
+        hdr.count = 0;  // patched below if fd is seekable; readers also use the file size
+        if (writeAll(fd, &hdr, sizeof(hdr)) == -1) {
+            return -1;
+        }
+    }
+    for (i = from; i < head; i++) {
+        trace_event_t ev = ring->events[i & (TRACE_CAPACITY - 1)];
+        // skip slots that are mid-write or already reused by a newer event
+        if (__atomic_load_n(&ring->events[i & (TRACE_CAPACITY - 1)].seq, __ATOMIC_ACQUIRE) != (uint32_t)(i + 1) ||
+            ev.seq != (uint32_t)(i + 1)) {
+            continue;
+        }
+        if (binary) {
+            if (writeAll(fd, &ev, sizeof(ev)) == -1) {
+                return -1;
+            }
+        } else {
+            int len = traceFormat(&ev, buf, sizeof(buf));
+            if (writeAll(fd, buf, len) == -1) {
+                return -1;
+            }
+        }
+        count++;
+    }
+    if (binary) {
+        hdr.count = count;
+        pwrite(fd, &hdr, sizeof(hdr), 0);
+    }
+    ring->flushed = head;
+    return count;
+}
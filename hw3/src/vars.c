@@ -0,0 +1,320 @@
+#include "vars.h"
+#include "arena.h"
+#include <ctype.h>
+#include <unistd.h>
+
+#define VARS_MIN_SLOTS 64
+
+extern char** environ;
+
+/*
+ * Open-addressing hash table keyed by name. Removed slots become
+ * tombstones (name set, value NULL) so probe chains stay intact.
+ */
+typedef struct var {
+    char* name;
+    char* value;
+    int exported;
+    unsigned int hash;
+} var_t;
+
+static var_t* slots = NULL;
+static int nslots = 0;
+static int used = 0;            // live entries plus tombstones
+static int envDirty = 1;        // an exported variable changed since the last build
+static char** envBlock = NULL;  // cached envp for exec
+static char* envStrings = NULL; // "NAME=value" strings of envBlock, one buffer
+
+static unsigned int hashName(const char* s, size_t len) {
+    unsigned int h = 2166136261u;
+    while (len-- > 0) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
+}
+
+static int validName(const char* s, size_t len) {
+    size_t i;
+    if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_')) {
+        return 0;
+    }
+    for (i = 1; i < len; i++) {
+        if (!(isalnum((unsigned char)s[i]) || s[i] == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void importEnviron();
+
+// slot holding name, or the slot where it would be inserted
+static var_t* findSlot(const char* name, size_t len, unsigned int hash) {
+    var_t* tomb = NULL;
+    unsigned int i = hash & (nslots - 1);
+
+    if (slots == NULL) {
+        importEnviron();
+        i = hash & (nslots - 1);
+    }
+    while (slots[i].name != NULL) {
+        if (slots[i].hash == hash && strncmp(slots[i].name, name, len) == 0 && slots[i].name[len] == '\0') {
+            return &slots[i];
+        }
+        if (slots[i].value == NULL && tomb == NULL) {
+            tomb = &slots[i];
+        }
+        i = (i + 1) & (nslots - 1);
+    }
+    return tomb != NULL ? tomb : &slots[i];
+}
+
+static void grow() {
+    var_t* old = slots;
+    int oldN = nslots;
+    int i;
+
+    nslots = nslots ? nslots * 2 : VARS_MIN_SLOTS;
+    slots = calloc(nslots, sizeof(var_t));
+    used = 0;
+    for (i = 0; i < oldN; i++) {
+        if (old[i].value == NULL) {
+            free(old[i].name);
+            continue;
+        }
+        unsigned int j = old[i].hash & (nslots - 1);
+        while (slots[j].name != NULL) {
+            j = (j + 1) & (nslots - 1);
+        }
+        slots[j] = old[i];
+        used++;
+    }
+    free(old);
+}
+
+static int setLen(const char* name, size_t len, const char* value, int exported) {
+    unsigned int hash = hashName(name, len);
+
+    if (!validName(name, len)) {
+        return -1;
+    }
+    if (slots == NULL) {
+        importEnviron();
+    }
+    if ((used + 1) * 4 > nslots * 3) {
+        grow();
+    }
+    var_t* v = findSlot(name, len, hash);
+    if (v->name == NULL || v->value == NULL) {   // new entry (or reused tombstone)
+        if (v->name == NULL) {
+            used++;
+        } else {
+            free(v->name);
+        }
+        v->name = strndup(name, len);
+        v->hash = hash;
+        v->exported = 0;
+    } else {
+        free(v->value);
+    }
+    v->value = strdup(value);
+    v->exported |= exported;
+    if (v->exported) {
+        envDirty = 1;
+    }
+    return 0;
+}
+
+static void importEnviron() {
+    char** e;
+
+    // set up an empty table first; setLen below calls back in here otherwise
+    nslots = VARS_MIN_SLOTS;
+    slots = calloc(nslots, sizeof(var_t));
+    for (e = environ; *e != NULL; e++) {
+        char* eq = strchr(*e, '=');
+        if (eq != NULL) {
+            setLen(*e, eq - *e, eq + 1, 1);
+        }
+    }
+    envDirty = 1;
+}
+
+char* varGet(const char* name) {
+    var_t* v = findSlot(name, strlen(name), hashName(name, strlen(name)));
+    return v->name != NULL ? v->value : NULL;
+}
+
+int varSet(const char* name, const char* value, int exported) {
+    return setLen(name, strlen(name), value, exported);
+}
+
+int varExport(const char* name) {
+    var_t* v = findSlot(name, strlen(name), hashName(name, strlen(name)));
+    if (v->name == NULL || v->value == NULL) {
+        return -1;
+    }
+    if (!v->exported) {
+        v->exported = 1;
+        envDirty = 1;
+    }
+    return 0;
+}
+
+void varUnset(const char* name) {
+    var_t* v = findSlot(name, strlen(name), hashName(name, strlen(name)));
+    if (v->name == NULL || v->value == NULL) {
+        return;
+    }
+    if (v->exported) {
+        envDirty = 1;
+    }
+    free(v->value);
+    v->value = NULL;    // tombstone
+    v->exported = 0;
+}
+
+char** varsEnviron() {
+    size_t bytes = 0;
+    int count = 0, i, n = 0;
+
+    if (slots == NULL) {    // never modified: children see environ as is
+        return environ;
+    }
+    if (!envDirty) {
+        return envBlock;
+    }
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].value != NULL && slots[i].exported) {
+            bytes += strlen(slots[i].name) + strlen(slots[i].value) + 2;
+            count++;
+        }
+    }
+    free(envBlock);
+    free(envStrings);
+    envBlock = malloc((count + 1) * sizeof(char*));
+    envStrings = malloc(bytes + 1);
+
+    char* p = envStrings;
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].value != NULL && slots[i].exported) {
+            envBlock[n++] = p;
+            p += sprintf(p, "%s=%s", slots[i].name, slots[i].value) + 1;
+        }
+    }
+    envBlock[n] = NULL;
+    envDirty = 0;
+    return envBlock;
+}
+
+void varsPrint() {
+    char** e;
+    for (e = varsEnviron(); *e != NULL; e++) {
+        printf("export %s\n", *e);
+    }
+}
+
+// expand one word into the arena; returns the word itself if it has no '$'
+static char* expandWord(char* word) {
+    size_t len = 0, size;
+    char* out;
+    char* p;
+
+    if (word == NULL || strchr(word, '$') == NULL) {
+        return word;
+    }
+
+    // first pass sizes the result, second pass writes it
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            out = arenaAlloc(len + 1);
+            size = len;
+            len = 0;
+        }
+        for (p = word; *p;) {
+            char* name = NULL;
+            size_t nlen = 0;
+            if (p[0] == '$' && p[1] == '{') {
+                char* close = strchr(p + 2, '}');
+                if (close != NULL && validName(p + 2, close - p - 2)) {
+                    name = p + 2;
+                    nlen = close - p - 2;
+                    p = close + 1;
+                }
+            } else if (p[0] == '$' && (isalpha((unsigned char)p[1]) || p[1] == '_')) {
+                name = p + 1;
+                for (nlen = 1; isalnum((unsigned char)name[nlen]) || name[nlen] == '_'; nlen++)
+                    ;
+                p = name + nlen;
+            }
+            if (name == NULL) {     // not a variable reference: copy as is
+                if (pass == 1) {
+                    out[len] = *p;
+                }
+                len++;
+                p++;
+                continue;
+            }
+            var_t* v = findSlot(name, nlen, hashName(name, nlen));
+            if (v->name != NULL && v->value != NULL) {
+                size_t vlen = strlen(v->value);
+                if (pass == 1) {
+                    memcpy(out + len, v->value, vlen);
+                }
+                len += vlen;
+            }
+        }
+    }
+    out[size] = '\0';
+    return out;
+}
+
+int expandVars(job_info* job) {
+    proc_info* proc;
+    int changed = 0, i;
+    char* w;
+
+    for (proc = job->procs; proc != NULL; proc = proc->next_proc) {
+        for (i = 0; i < proc->argc; i++) {
+            if ((w = expandWord(proc->argv[i])) != proc->argv[i]) {
+                proc->argv[i] = w;
+                changed++;
+            }
+        }
+        proc->cmd = proc->argv[0];
+        proc->err_file = expandWord(proc->err_file);
+    }
+    job->in_file = expandWord(job->in_file);
+    job->out_file = expandWord(job->out_file);
+    return changed;
+}
+
+void exportCommand(proc_info* proc) {
+    int i;
+
+    if (proc->argc == 1) {
+        varsPrint();
+        return;
+    }
+    for (i = 1; i < proc->argc; i++) {
+        char* eq = strchr(proc->argv[i], '=');
+        int rc = 0;
+        if (eq != NULL) {
+            rc = setLen(proc->argv[i], eq - proc->argv[i], eq + 1, 1);
+        } else if (!validName(proc->argv[i], strlen(proc->argv[i]))) {
+            rc = -1;
+        } else {
+            varExport(proc->argv[i]);   // exporting an unset name is a no-op
+        }
+        if (rc == -1) {
+            fprintf(stderr, VAR_ERR, proc->argv[i]);
+        }
+    }
+}
+
+void unsetCommand(proc_info* proc) {
+    int i;
+    for (i = 1; i < proc->argc; i++) {
+        varUnset(proc->argv[i]);
+    }
+}
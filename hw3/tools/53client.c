@@ -0,0 +1,132 @@
+/*
+ * Minimal client for 53shell --listen. Sends each command (or each line of
+ * stdin if none are given) to the daemon, with this process's stdio as the
+ * stdio of the jobs, and waits for every foreground line to finish.
+ *
+ * usage: 53client [-v] <socket> [command ...]
+ *
+ * -v prints every reply of the daemon to stderr. The exit status is that of
+ * the last foreground line.
+ */
+#include "daemon.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int verbose = 0;
+
+static int sendLine(int sock, const char* line, int* fds) {
+    char ctl[CMSG_SPACE(4 * sizeof(int))];
+    struct iovec iov = {(void*)line, strlen(line)};
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fds != NULL) {
+        memset(ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl;
+        msg.msg_controllen = sizeof(ctl);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        int nfds = fds[3] == -1 ? 3 : 4;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    return sendmsg(sock, &msg, 0) == -1 ? -1 : 0;
+}
+
+// read replies until line seq is done; returns its exit code, -1 if the daemon left
+static int waitLine(int sock, unsigned int seq) {
+    char buf[128];
+    unsigned int rseq;
+    char kind[8];
+    int pid, code;
+    ssize_t n;
+
+    while ((n = recv(sock, buf, sizeof(buf) - 1, 0)) > 0) {
+        buf[n] = '\0';
+        if (verbose) {
+            fputs(buf, stderr);
+        }
+        code = 0;
+        if (sscanf(buf, "%u %7s %d %d", &rseq, kind, &pid, &code) < 3 || rseq != seq) {
+            continue;
+        }
+        // a background line is done once started; its exit is reported later
+        if (strcmp(kind, "bg") == 0 || strcmp(kind, "exit") == 0) {
+            return code;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    struct sockaddr_un addr;
+    int fds[4] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1};
+    unsigned int seq = 0;
+    int status = 0;
+    int argi = 1;
+    int sock;
+
+    if (argi < argc && strcmp(argv[argi], "-v") == 0) {
+        verbose = 1;
+        argi++;
+    }
+    if (argi >= argc) {
+        fprintf(stderr, "usage: %s [-v] <socket> [command ...]\n", argv[0]);
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[argi], sizeof(addr.sun_path) - 1);
+    sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror(argv[argi]);
+        return 1;
+    }
+    argi++;
+    // jobs start in our directory
+    fds[3] = open(".", O_PATH | O_DIRECTORY);
+
+    // commands on the command line
+    if (argi < argc) {
+        for (; argi < argc && status != -1; argi++) {
+            if (argv[argi][0] == '\0') {
+                continue;
+            }
+            sendLine(sock, argv[argi], seq == 0 ? fds : NULL);
+            status = waitLine(sock, ++seq);
+        }
+        return status == -1 ? 1 : status;
+    }
+
+    // commands on stdin, which the jobs must then not share
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    fds[0] = open("/dev/null", O_RDONLY);
+    while (status != -1 && (len = getline(&line, &cap, stdin)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (len == 0) {     // an empty packet would read as a hangup
+            continue;
+        }
+        if (len >= DAEMON_LINE_MAX) {
+            fprintf(stderr, "line too long\n");
+            continue;
+        }
+        sendLine(sock, line, seq == 0 ? fds : NULL);
+        status = waitLine(sock, ++seq);
+    }
+    free(line);
+    return status == -1 ? 1 : status;
+}
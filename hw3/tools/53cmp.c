@@ -0,0 +1,143 @@
+/*
+ * Compare two recordings of the same session, e.g. two builds replaying one
+ * production recording:
+ *
+ *     old/53shell --replay prod.rec --record a.rec
+ *     new/53shell --replay prod.rec --record b.rec
+ *     53cmp a.rec b.rec
+ *
+ * Prints the latency of every line in both (read until ready for the next
+ * line), the change, and both exit statuses, marking lines whose status or
+ * number of spawned processes differ. Built with `make bench`.
+ *
+ * usage: 53cmp [-t <percent>] <a.rec> <b.rec>
+ *
+ * -t only lists lines whose latency changed by more than percent (status
+ * differences are always listed). Exits with 1 if any status differs.
+ */
+#include "record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct rline {
+    char* text;
+    unsigned long long start;
+    unsigned long long latency;
+    int status;
+    int spawns;
+    int done;
+} rline_t;
+
+typedef struct session {
+    rline_t* lines;
+    int count;
+} session_t;
+
+static int load(const char* path, session_t* s) {
+    FILE* f = fopen(path, "r");
+    char* buf = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int capLines = 0;
+    unsigned long long ns;
+    int status, off;
+    char event[16];
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    s->lines = NULL;
+    s->count = 0;
+    while ((len = getline(&buf, &cap, f)) > 0) {
+        if (buf[len - 1] == '\n') {
+            buf[--len] = '\0';
+        }
+        rline_t* cur = s->count > 0 ? &s->lines[s->count - 1] : NULL;
+        if (sscanf(buf, "L %llu %n", &ns, &off) == 1) {
+            if (s->count == capLines) {
+                capLines = capLines ? capLines * 2 : 256;
+                s->lines = realloc(s->lines, capLines * sizeof(rline_t));
+            }
+            cur = &s->lines[s->count++];
+            memset(cur, 0, sizeof(rline_t));
+            cur->text = strdup(buf + off);
+            cur->start = ns;
+        } else if (cur != NULL && !cur->done && sscanf(buf, "D %llu %d", &ns, &status) == 2) {
+            cur->latency = ns - cur->start;
+            cur->status = status;
+            cur->done = 1;
+        } else if (cur != NULL && !cur->done && sscanf(buf, "E %llu %15s", &ns, event) == 2 &&
+                   strcmp(event, "spawn") == 0) {
+            cur->spawns++;
+        }
+    }
+    free(buf);
+    fclose(f);
+    return 0;
+}
+
+static int cmpULL(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char* argv[]) {
+    session_t a, b;
+    double threshold = -1;
+    unsigned long long totalA = 0, totalB = 0;
+    int argi = 1, n, i, statusDiffs = 0;
+
+    if (argi + 1 < argc && strcmp(argv[argi], "-t") == 0) {
+        threshold = atof(argv[argi + 1]);
+        argi += 2;
+    }
+    if (argc - argi != 2) {
+        fprintf(stderr, "usage: %s [-t <percent>] <a.rec> <b.rec>\n", argv[0]);
+        return 2;
+    }
+    if (load(argv[argi], &a) == -1 || load(argv[argi + 1], &b) == -1) {
+        return 2;
+    }
+    if (a.count != b.count) {
+        fprintf(stderr, "warning: %d lines vs %d lines, comparing the first %d\n",
+                a.count, b.count, a.count < b.count ? a.count : b.count);
+    }
+    n = a.count < b.count ? a.count : b.count;
+
+    unsigned long long* ratios = malloc((n ? n : 1) * sizeof(unsigned long long));
+    int nratios = 0;
+    printf("%5s %10s %10s %8s %7s  %s\n", "line", "a ms", "b ms", "change", "status", "command");
+    for (i = 0; i < n; i++) {
+        rline_t* x = &a.lines[i];
+        rline_t* y = &b.lines[i];
+        double msA = x->latency / 1e6, msB = y->latency / 1e6;
+        double change = x->latency ? 100.0 * ((double)y->latency - x->latency) / x->latency : 0;
+        int differs = x->status != y->status || x->spawns != y->spawns;
+
+        if (strcmp(x->text, y->text) != 0) {
+            fprintf(stderr, "line %d differs: '%s' vs '%s'\n", i + 1, x->text, y->text);
+            return 2;
+        }
+        totalA += x->latency;
+        totalB += y->latency;
+        if (x->latency) {
+            ratios[nratios++] = (unsigned long long)(1000000.0 * y->latency / x->latency);
+        }
+        statusDiffs += x->status != y->status;
+        if (!differs && threshold >= 0 && (change < 0 ? -change : change) <= threshold) {
+            continue;
+        }
+        printf("%5d %10.3f %10.3f %+7.1f%% %3d%s%-3d  %s\n", i + 1, msA, msB, change,
+               x->status, differs ? "!" : " ", y->status, x->text);
+    }
+
+    qsort(ratios, nratios, sizeof(unsigned long long), cmpULL);
+    printf("\n%d lines: total %.3f ms -> %.3f ms (%+.1f%%), median change %+.1f%%, %d status differences\n",
+           n, totalA / 1e6, totalB / 1e6,
+           totalA ? 100.0 * ((double)totalB - totalA) / totalA : 0.0,
+           nratios ? ratios[nratios / 2] / 10000.0 - 100.0 : 0.0, statusDiffs);
+    free(ratios);
+    return statusDiffs ? 1 : 0;
+}
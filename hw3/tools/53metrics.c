@@ -0,0 +1,160 @@
+/*
+ * Print the live counters of a shell started with `--metrics <file>`:
+ *
+ *     53shell --metrics /run/user/1000/53shell.metrics
+ *     53metrics /run/user/1000/53shell.metrics
+ *
+ * The page is mapped read-only, so reading it costs the shell nothing.
+ *
+ * usage: 53metrics [-p] [-i <secs>] <file>
+ *
+ * -p prints the Prometheus text format instead, for a node exporter's
+ * textfile collector or a scrape wrapper. -i prints again every secs
+ * seconds until the shell exits.
+ */
+#include "metrics.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOAD(field) __atomic_load_n(&page->field, __ATOMIC_RELAXED)
+
+// upper bound in microseconds of the bucket holding the q-quantile
+static unsigned long long quantile(const uint64_t* hist, double q) {
+    uint64_t total = 0, seen = 0;
+    int i;
+
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        total += __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < METRICS_BUCKETS && total > 0; i++) {
+        seen += __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+        if (seen >= q * total) {
+            return 2ULL << i;
+        }
+    }
+    return 0;
+}
+
+static void printText(const metrics_page_t* page) {
+    uint64_t lines = LOAD(lines);
+    uint64_t reaped = LOAD(reaped);
+
+    printf("shell %d%s\n", page->pid, kill(page->pid, 0) == 0 ? "" : " (gone)");
+    printf("jobs spawned       %llu\n", (unsigned long long)LOAD(spawned));
+    printf("active bg jobs     %llu\n", (unsigned long long)LOAD(bgActive));
+    printf("exec failures      %llu\n", (unsigned long long)LOAD(execFailures));
+    printf("reaped             %llu, lag avg %.3f ms, max %.3f ms\n", (unsigned long long)reaped,
+           reaped ? LOAD(reapLagNs) / 1e6 / reaped : 0.0, LOAD(reapLagMaxNs) / 1e6);
+    printf("lines parsed       %llu, avg %.1f us\n", (unsigned long long)lines,
+           lines ? LOAD(parseNs) / 1e3 / lines : 0.0);
+    printf("spawn latency      p50 < %llu us, p99 < %llu us\n",
+           quantile(page->spawnHist, 0.5), quantile(page->spawnHist, 0.99));
+    printf("parse latency      p50 < %llu us, p99 < %llu us\n",
+           quantile(page->parseHist, 0.5), quantile(page->parseHist, 0.99));
+    printf("pipe bytes         %llu\n", (unsigned long long)LOAD(pipeBytes));
+}
+
+static void printHistogram(const char* name, const uint64_t* hist, uint64_t sumNs) {
+    uint64_t count = 0;
+    int i;
+
+    printf("# TYPE %s histogram\n", name);
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        count += __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+        if (i < METRICS_BUCKETS - 1) {
+            printf("%s_bucket{le=\"%g\"} %llu\n", name, (2ULL << i) / 1e6, (unsigned long long)count);
+        }
+    }
+    printf("%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+    printf("%s_sum %.9f\n", name, sumNs / 1e9);
+    printf("%s_count %llu\n", name, (unsigned long long)count);
+}
+
+static void printPrometheus(const metrics_page_t* page) {
+    printf("# TYPE shell_jobs_spawned_total counter\nshell_jobs_spawned_total %llu\n",
+           (unsigned long long)LOAD(spawned));
+    printf("# TYPE shell_bg_jobs_active gauge\nshell_bg_jobs_active %llu\n",
+           (unsigned long long)LOAD(bgActive));
+    printf("# TYPE shell_exec_failures_total counter\nshell_exec_failures_total %llu\n",
+           (unsigned long long)LOAD(execFailures));
+    printf("# TYPE shell_reaped_total counter\nshell_reaped_total %llu\n",
+           (unsigned long long)LOAD(reaped));
+    printf("# TYPE shell_reap_lag_seconds_total counter\nshell_reap_lag_seconds_total %.9f\n",
+           LOAD(reapLagNs) / 1e9);
+    printf("# TYPE shell_reap_lag_seconds_max gauge\nshell_reap_lag_seconds_max %.9f\n",
+           LOAD(reapLagMaxNs) / 1e9);
+    printf("# TYPE shell_lines_parsed_total counter\nshell_lines_parsed_total %llu\n",
+           (unsigned long long)LOAD(lines));
+    printf("# TYPE shell_parse_seconds_total counter\nshell_parse_seconds_total %.9f\n",
+           LOAD(parseNs) / 1e9);
+    printf("# TYPE shell_pipe_bytes_total counter\nshell_pipe_bytes_total %llu\n",
+           (unsigned long long)LOAD(pipeBytes));
+    printHistogram("shell_spawn_seconds", page->spawnHist, LOAD(spawnNs));
+    printHistogram("shell_parse_seconds", page->parseHist, LOAD(parseNs));
+}
+
+int main(int argc, char* argv[]) {
+    metrics_page_t* page;
+    struct stat st;
+    int prometheus = 0;
+    int interval = 0;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "pi:")) != -1) {
+        if (opt == 'p') {
+            prometheus = 1;
+        } else if (opt == 'i') {
+            interval = atoi(optarg);
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-p] [-i <secs>] <file>\n", argv[0]);
+        return 1;
+    }
+    if ((fd = open(argv[optind], O_RDONLY)) == -1) {
+        perror(argv[optind]);
+        return 1;
+    }
+    // a short file would fault on access instead of failing here
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(metrics_page_t)) {
+        fprintf(stderr, "%s: not a 53shell metrics page\n", argv[optind]);
+        return 1;
+    }
+    page = mmap(NULL, sizeof(metrics_page_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (memcmp(page->magic, METRICS_MAGIC, sizeof(page->magic)) != 0) {
+        fprintf(stderr, "%s: not a 53shell metrics page\n", argv[optind]);
+        return 1;
+    }
+    if (__atomic_load_n(&page->version, __ATOMIC_ACQUIRE) != METRICS_VERSION) {
+        fprintf(stderr, "%s: unsupported metrics version %u\n", argv[optind], page->version);
+        return 1;
+    }
+
+    for (;;) {
+        if (prometheus) {
+            printPrometheus(page);
+        } else {
+            printText(page);
+        }
+        fflush(stdout);
+        if (interval <= 0 || kill(page->pid, 0) == -1) {
+            return 0;
+        }
+        sleep(interval);
+        printf("\n");
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * Convert a binary trace written by `trace flush -b <file>` into JSON lines.
+ * Built with `make debug`.
+ *
+ * usage: 53trace <file>
+ */
+#include "trace.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]) {
+    trace_file_header_t hdr;
+    trace_event_t ev;
+    char buf[128];
+    int fd;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    if ((fd = open(argv[1], O_RDONLY)) == -1) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a 53shell trace\n", argv[1]);
+        return 1;
+    }
+    if (hdr.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: unsupported trace version %u\n", argv[1], hdr.version);
+        return 1;
+    }
+    // the count in the header is advisory; read until the end of the file
+    while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+        int len = traceFormat(&ev, buf, sizeof(buf));
+        fwrite(buf, 1, len, stdout);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Glob expansion on a large directory: the shell's getdents64 engine (cold,
+ * cached within a line, cached across lines) against glob(3).
+ * Built with `make bench`.
+ *
+ * usage: globbench [dir] [entries]
+ *        creates dir (default /tmp/53glob) with entries files if needed
+ */
+#include "pathglob.h"
+#include <glob.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void populate(const char* dir, int entries) {
+    char path[4096];
+    struct stat st;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/f%07d.log", dir, entries - 1);
+    if (stat(path, &st) == 0) {
+        return;
+    }
+    mkdir(dir, 0755);
+    for (i = 0; i < entries; i++) {
+        snprintf(path, sizeof(path), "%s/f%07d.%s", dir, i, i % 10 ? "log" : "txt");
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1) {
+            perror(path);
+            exit(1);
+        }
+        close(fd);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    char pattern[4096];
+    char** matches;
+    glob_t g;
+    double t;
+    int n;
+
+    const char* dir = argc > 1 ? argv[1] : "/tmp/53glob";
+    int entries = argc > 2 ? atoi(argv[2]) : 100000;
+    populate(dir, entries);
+    snprintf(pattern, sizeof(pattern), "%s/*5?.log", dir);
+
+    t = now();
+    n = globWord(pattern, &matches);
+    printf("%-34s %8.2f ms  %d matches\n", "53shell cold (getdents64)", now() - t, n);
+
+    t = now();
+    n = globWord(pattern, &matches);
+    printf("%-34s %8.2f ms  %d matches\n", "53shell same line (cached)", now() - t, n);
+
+    globCacheLines = 1;
+    globReset();
+    t = now();
+    n = globWord(pattern, &matches);
+    printf("%-34s %8.2f ms  %d matches\n", "53shell next line (mtime checked)", now() - t, n);
+
+    t = now();
+    glob(pattern, 0, NULL, &g);
+    printf("%-34s %8.2f ms  %zu matches\n", "glob(3)", now() - t, g.gl_pathc);
+    globfree(&g);
+    return 0;
+}
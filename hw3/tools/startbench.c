@@ -0,0 +1,85 @@
+/*
+ * Startup latency of `53shell -c`: time from exec'ing the shell until the
+ * command it runs starts. The command is this program in --stamp mode,
+ * which writes its CLOCK_MONOTONIC start time to the pipe in $STAMP_FD.
+ * Built with `make bench`.
+ *
+ * usage: startbench [shell] [iterations]
+ *        e.g. startbench bin/53shell 500, or startbench /bin/sh for a baseline
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned long long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmpull(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char* argv[]) {
+    char self[4096], cmd[4200], fdstr[16];
+    unsigned long long start, stamp, sum = 0;
+    int fds[2], i, status;
+
+    if (argc > 1 && strcmp(argv[1], "--stamp") == 0) {
+        stamp = now();
+        char* fd = getenv("STAMP_FD");
+        return fd != NULL && write(atoi(fd), &stamp, sizeof(stamp)) == sizeof(stamp) ? 0 : 1;
+    }
+
+    char* shell = argc > 1 ? argv[1] : "bin/53shell";
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+    unsigned long long* samples = malloc(iterations * sizeof(unsigned long long));
+
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s [shell] [iterations]\n", argv[0]);
+        return 1;
+    }
+    self[len] = '\0';
+    snprintf(cmd, sizeof(cmd), "%s --stamp", self);
+
+    for (i = 0; i < iterations; i++) {
+        if (pipe(fds) == -1) {
+            perror("pipe");
+            return 1;
+        }
+        snprintf(fdstr, sizeof(fdstr), "%d", fds[1]);
+        setenv("STAMP_FD", fdstr, 1);
+
+        start = now();
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            execl(shell, shell, "-c", cmd, (char*)NULL);
+            _exit(127);
+        }
+        close(fds[1]);
+        if (read(fds[0], &stamp, sizeof(stamp)) != sizeof(stamp)) {
+            fprintf(stderr, "%s -c did not run the command\n", shell);
+            return 1;
+        }
+        close(fds[0]);
+        waitpid(pid, &status, 0);
+        samples[i] = stamp - start;
+        sum += samples[i];
+    }
+
+    qsort(samples, iterations, sizeof(unsigned long long), cmpull);
+    printf("%s -c: %d runs, exec to first child spawn\n", shell, iterations);
+    printf("  min    %8.1f us\n", samples[0] / 1e3);
+    printf("  median %8.1f us\n", samples[iterations / 2] / 1e3);
+    printf("  p99    %8.1f us\n", samples[iterations * 99 / 100] / 1e3);
+    printf("  mean   %8.1f us\n", sum / 1e3 / iterations);
+    free(samples);
+    return 0;
+}